@@ -1 +1 @@
-clang++ -g -Wall `sdl2-config --cflags` `sdl2-config --libs` -lSDL2_image -framework OpenGL src/main.cpp -o voxel
+clang++ -g -Wall -std=c++11 -msse4.1 `sdl2-config --cflags` `sdl2-config --libs` -lSDL2_image -framework OpenGL src/main.cpp -o voxel
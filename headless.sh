@@ -0,0 +1 @@
+clang++ -O2 -g -Wall -std=c++11 -msse4.1 -pthread src/headless.cpp -o voxel_headless -lEGL -lGL
@@ -0,0 +1,1748 @@
+// Headless benchmark for the world pipeline (generate_chunk, hull_chunk,
+// update_chunk). Builds without SDL or GL and prints its results as JSON.
+//
+// usage: voxel_bench [-r runs] [-s size[,size...]] [-j workers] [-p samples] [-m] [-c] [-o] [-l] [-t] [-k] [-d] [-e] [-y] [-a] [-i] [-x trace.json]
+//   each size is a square world of size x size chunks, e.g. -s 3,9,17
+//   workers sets the job system size for the parallel build, 0 = all cores
+//   -p runs only the noise microbenchmark, batched kernel against scalar stb
+//   -m runs only the mesher comparison, instanced cubes against greedy meshes
+//   -c runs only the frustum culling pass over synthetic chunk bounds
+//   -l runs only the level of detail comparison, triangles with the camera at
+//      the centre of each world size against full resolution greedy meshes
+//   -t runs only a streaming fly-through, with each size as the view radius,
+//      and checks streamed chunks against chunks built on their own
+//   -k runs only the chunk lookup comparison, flat array against chunk map
+//      against cached neighbour pointers
+//   -d runs only the region file comparison, generating each world against
+//      loading it from disk with a cold and a warm page cache
+//   -e runs only random block edits, timing each one and checking the edited
+//      chunks against a full rebuild
+//   -y runs only the raycast throughput test at several ray lengths, checked
+//      against stepping through every cell; rays that graze a block edge
+//      may count as mismatched, since the two round differently there
+//   -a runs only the ambient occlusion cost, chunk builds with it against
+//      without it, and checks it against counting each corner's cells
+//   -i runs only the heightmap TGA comparison, the old 32-bit bitmap writer
+//      against streaming greyscale, plain and run-length encoded, with each
+//      file read back and checked
+//   -x writes a Chrome trace of whichever run it is to the given file
+//   -o runs only a low fly-through over generated terrain and reports how
+//      many chunks the horizon occlusion pass rejects
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "stb_perlin.h"
+
+#include "common.h"
+#include "point.h"
+#include "chunk.h"
+#include "jobs.h"
+#include "world.h"
+#include "streaming.h"
+#include "region.h"
+#include "edit.h"
+#include "raycast.h"
+#include "mesher.h"
+#include "lod.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "tga.h"
+#include "heightmap.h"
+#include "timer.h"
+#include "trace.h"
+
+typedef struct Samples {
+	u64 *values;
+	u32 count;
+	u32 capacity;
+} Samples;
+
+void push_sample(Samples *s, u64 value) {
+	if (s->count == s->capacity) {
+		s->capacity = s->capacity ? s->capacity * 2 : 256;
+		s->values = (u64 *)realloc(s->values, sizeof(u64) * s->capacity);
+	}
+	s->values[s->count++] = value;
+}
+
+int compare_u32(const void *a, const void *b) {
+	u32 x = *(const u32 *)a;
+	u32 y = *(const u32 *)b;
+	return (x > y) - (x < y);
+}
+
+int compare_u64(const void *a, const void *b) {
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+	return (x > y) - (x < y);
+}
+
+u64 percentile(Samples *s, f64 p) {
+	if (s->count == 0) {
+		return 0;
+	}
+	u32 idx = (u32)(p * (f64)(s->count - 1) + 0.5);
+	return s->values[idx];
+}
+
+void print_stats(const char *name, Samples *s, bool last) {
+	qsort(s->values, s->count, sizeof(u64), compare_u64);
+	printf("        \"%s\": { \"samples\": %u, \"min_us\": %.3f, \"median_us\": %.3f, \"p99_us\": %.3f }%s\n",
+		   name, s->count,
+		   (f64)percentile(s, 0.0) / 1000.0,
+		   (f64)percentile(s, 0.5) / 1000.0,
+		   (f64)percentile(s, 0.99) / 1000.0,
+		   last ? "" : ",");
+	s->count = 0;
+}
+
+bool chunks_match(Chunk *a, Chunk *b) {
+	if (a->num_blocks != b->num_blocks || a->num_instances != b->num_instances) {
+		return false;
+	}
+	if (memcmp(a->real_blocks, b->real_blocks, chunk_width * chunk_depth) ||
+		memcmp(a->occupancy, b->occupancy, sizeof(u64) * chunk_width * chunk_depth * COLUMN_WORDS) ||
+		memcmp(a->pre_render_list, b->pre_render_list, chunk_size) ||
+		memcmp(a->face_masks, b->face_masks, chunk_size) ||
+		memcmp(a->instances, b->instances, sizeof(u32) * a->num_instances)) {
+		return false;
+	}
+	return true;
+}
+
+// Brute-force check of hull_chunk's face masks: every face of every solid
+// cell is tested against the cell next to it, and exactly the cells with an
+// exposed face must be marked
+bool face_masks_match(Chunk **chunks, u32 chunk_idx) {
+	Chunk *chunk = chunks[chunk_idx];
+	for (u32 i = 0; i < chunk_size; i++) {
+		u8 expected = 0;
+		Point p = oned_to_threed(i, chunk_width, chunk_height);
+		if (chunk_block_solid(chunk, p.x, p.y, p.z)) {
+			for (u32 f = 0; f < NUM_FACES; f++) {
+				i32 nx = (i32)p.x + face_normals[f][0];
+				i32 ny = (i32)p.y + face_normals[f][1];
+				i32 nz = (i32)p.z + face_normals[f][2];
+				if (!chunk_block_solid(chunk, nx, ny, nz)) {
+					expected |= 1 << f;
+				}
+			}
+		}
+		if (chunk->face_masks[i] != expected || (chunk->pre_render_list[i] != 0) != (expected != 0)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Samples laid out like generate_chunk's octave loop: runs of chunk columns
+// at the three octave scales it uses, on both sides of the world origin
+void bench_perlin(u32 num_samples, u32 runs) {
+	f32 *xs = (f32 *)malloc(sizeof(f32) * num_samples);
+	f32 *ys = (f32 *)malloc(sizeof(f32) * num_samples);
+	f32 *zs = (f32 *)malloc(sizeof(f32) * num_samples);
+	f32 *scalar = (f32 *)malloc(sizeof(f32) * num_samples);
+	f32 *batch = (f32 *)malloc(sizeof(f32) * num_samples);
+
+	for (u32 i = 0; i < num_samples; i++) {
+		u8 o = 5 + (i / 256) % 3;
+		f32 scale = (f32)(2 << o) * 1.01f;
+		xs[i] = (f32)((i32)(i % 4096) - 2048) / scale;
+		ys[i] = (f32)((i32)((i / 16) % 4096) - 2048) / scale;
+		zs[i] = o * 2.0f;
+	}
+
+	u64 scalar_ns = ~0ul;
+	u64 batch_ns = ~0ul;
+	for (u32 r = 0; r < runs; r++) {
+		u64 start = get_time_ns();
+		for (u32 i = 0; i < num_samples; i++) {
+			scalar[i] = stb_perlin_noise3(xs[i], ys[i], zs[i], 256, 256, 256);
+		}
+		u64 mid = get_time_ns();
+		perlin_noise3_batch(xs, ys, zs, num_samples, 256, 256, 256, batch);
+		u64 end = get_time_ns();
+
+		if (mid - start < scalar_ns) {
+			scalar_ns = mid - start;
+		}
+		if (end - mid < batch_ns) {
+			batch_ns = end - mid;
+		}
+	}
+
+	u32 mismatches = 0;
+	f32 max_error = 0.0f;
+	for (u32 i = 0; i < num_samples; i++) {
+		f32 error = fabsf(scalar[i] - batch[i]);
+		mismatches += scalar[i] != batch[i];
+		if (error > max_error) {
+			max_error = error;
+		}
+	}
+
+	printf("{\n  \"perlin\": {\n");
+	printf("    \"lanes\": %u,\n", PERLIN_LANES);
+	printf("    \"samples\": %u,\n", num_samples);
+	printf("    \"scalar_samples_per_sec\": %.1f,\n", (f64)num_samples / ((f64)scalar_ns / 1000000000.0));
+	printf("    \"batch_samples_per_sec\": %.1f,\n", (f64)num_samples / ((f64)batch_ns / 1000000000.0));
+	printf("    \"speedup\": %.2f,\n", (f64)scalar_ns / (f64)batch_ns);
+	printf("    \"mismatches\": %u,\n", mismatches);
+	printf("    \"max_abs_error\": %g\n", max_error);
+	printf("  }\n}\n");
+
+	free(xs);
+	free(ys);
+	free(zs);
+	free(scalar);
+	free(batch);
+}
+
+// Triangle counts and per-chunk build time of both render paths; the
+// instanced path's build step is update_chunk, the mesh path's is mesh_chunk.
+// Whole cubes are what the instanced path drew before face masks.
+void bench_mesher(JobSystem *jobs, u32 *sizes, u32 num_sizes, u32 runs) {
+	Samples instanced_samples = {};
+	Samples mesh_samples = {};
+
+	printf("{\n  \"runs\": %u,\n  \"mesher\": [\n", runs);
+	for (u32 s = 0; s < num_sizes; s++) {
+		num_x_chunks = sizes[s];
+		num_y_chunks = sizes[s];
+		num_chunks = num_x_chunks * num_y_chunks;
+
+		Chunk **chunks = (Chunk **)malloc(sizeof(Chunk *) * num_chunks);
+		build_world(jobs, chunks);
+
+		ChunkMesh mesh = {};
+		u64 cube_triangles = 0;
+		u64 face_triangles = 0;
+		u64 mesh_triangles = 0;
+		bool masks_match = true;
+
+		for (u32 r = 0; r < runs; r++) {
+			for (u32 i = 0; i < num_chunks; i++) {
+				u64 start = get_time_ns();
+				update_chunk(chunks, i);
+				u64 mid = get_time_ns();
+				mesh_chunk(chunks, i, &mesh);
+				u64 end = get_time_ns();
+
+				push_sample(&instanced_samples, mid - start);
+				push_sample(&mesh_samples, end - mid);
+
+				if (r == 0) {
+					cube_triangles += chunks[i]->num_blocks * 12;
+					face_triangles += chunks[i]->num_instances * 2;
+					mesh_triangles += mesh.num_indices / 3;
+					masks_match = masks_match && face_masks_match(chunks, i);
+				}
+			}
+		}
+
+		printf("    {\n");
+		printf("      \"num_chunks\": %u,\n", num_chunks);
+		printf("      \"whole_cube_triangles\": %lu,\n", cube_triangles);
+		printf("      \"exposed_face_triangles\": %lu,\n", face_triangles);
+		printf("      \"mesh_triangles\": %lu,\n", mesh_triangles);
+		printf("      \"face_masks_match\": %s,\n", masks_match ? "true" : "false");
+		printf("      \"build\": {\n");
+		print_stats("update_chunk", &instanced_samples, false);
+		print_stats("mesh_chunk", &mesh_samples, true);
+		printf("      }\n");
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+
+		free_chunk_mesh(&mesh);
+		for (u32 i = 0; i < num_chunks; i++) {
+			free_chunk(chunks[i]);
+		}
+		free(chunks);
+	}
+	printf("  ]\n}\n");
+}
+
+// Culling cost per frame against world size. Boxes come from a fake
+// heightmap rather than generated chunks, so large grids stay cheap to set up;
+// cameras sit at random spots above the world looking at random headings.
+void bench_culling(u32 *sizes, u32 num_sizes, u32 runs) {
+	Samples cull_samples = {};
+	u32 frames = 256;
+
+	printf("{\n  \"runs\": %u,\n  \"culling\": [\n", runs);
+	for (u32 s = 0; s < num_sizes; s++) {
+		u32 side = sizes[s];
+		u32 count = side * side;
+		ChunkBounds bounds = create_chunk_bounds(count);
+		u8 *visible = (u8 *)malloc(count);
+
+		Chunk chunk = {};
+		for (u32 i = 0; i < count; i++) {
+			chunk.x_off = (i % side) * chunk_width;
+			chunk.z_off = (i / side) * chunk_depth;
+			chunk.min_y = rand() % 64;
+			chunk.max_y = chunk.min_y + rand() % 128;
+			set_chunk_bounds(&bounds, i, &chunk);
+		}
+
+		f32 world_w = (f32)(side * chunk_width);
+		f32 world_d = (f32)(side * chunk_depth);
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 1000.0f);
+		u64 drawn = 0;
+
+		srand(1);
+		for (u32 r = 0; r < runs; r++) {
+			for (u32 f = 0; f < frames; f++) {
+				f32 yaw = (f32)rand() / RAND_MAX * 6.2831853f;
+				f32 pitch = ((f32)rand() / RAND_MAX - 0.5f) * 1.5f;
+				glm::vec3 pos = glm::vec3((f32)rand() / RAND_MAX * world_w, 160.0f, (f32)rand() / RAND_MAX * world_d);
+				glm::vec3 front = glm::vec3(cosf(yaw) * cosf(pitch), sinf(pitch), sinf(yaw) * cosf(pitch));
+				glm::mat4 pv = projection * glm::lookAt(pos, pos + front, glm::vec3(0.0f, 1.0f, 0.0f));
+
+				u64 start = get_time_ns();
+				Frustum frustum = frustum_from_matrix(pv);
+				u32 n = cull_chunks(&bounds, &frustum, visible);
+				push_sample(&cull_samples, get_time_ns() - start);
+
+				if (r == 0) {
+					drawn += n;
+				}
+			}
+		}
+
+		printf("    {\n");
+		printf("      \"num_chunks\": %u,\n", count);
+		printf("      \"avg_drawn\": %.1f,\n", (f64)drawn / frames);
+		printf("      \"avg_culled\": %.1f,\n", count - (f64)drawn / frames);
+		printf("      \"pass\": {\n");
+		print_stats("cull_chunks", &cull_samples, true);
+		printf("      }\n");
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+
+		free(visible);
+		free_chunk_bounds(&bounds);
+	}
+	printf("  ]\n}\n");
+}
+
+// Terrain top in world columns, -1 outside the world
+i32 world_height(Chunk **chunks, i32 x, i32 z) {
+	if (x < 0 || z < 0 || x >= (i32)(num_x_chunks * chunk_width) || z >= (i32)(num_y_chunks * chunk_depth)) {
+		return -1;
+	}
+	Chunk *chunk = chunks[twod_to_oned(x / chunk_width, z / chunk_depth, num_x_chunks)];
+	return chunk->real_blocks[twod_to_oned(x % chunk_width, z % chunk_depth, chunk_width)];
+}
+
+// Marches from the camera to the top of every column of an occluded chunk
+// and counts the columns whose ray never passes through terrain on the way
+u32 count_unblocked_columns(Chunk **chunks, Chunk *chunk, glm::vec3 camera) {
+	u32 unblocked = 0;
+	for (u32 z = 0; z < chunk_depth; z++) {
+		for (u32 x = 0; x < chunk_width; x++) {
+			i32 wx = chunk->x_off + x;
+			i32 wz = chunk->z_off + z;
+			glm::vec3 target = glm::vec3(wx + 0.5f, world_height(chunks, wx, wz) + 1.0f, wz + 0.5f);
+			glm::vec3 delta = target - camera;
+			f32 dist = sqrtf(delta.x * delta.x + delta.z * delta.z);
+
+			bool blocked = false;
+			for (f32 t = 0.0f; t < dist && !blocked; t += 0.25f) {
+				glm::vec3 p = camera + delta * (t / dist);
+				i32 px = (i32)floorf(p.x);
+				i32 pz = (i32)floorf(p.z);
+				if (px == wx && pz == wz) {
+					break;
+				}
+				blocked = p.y < world_height(chunks, px, pz) + 1.0f;
+			}
+			unblocked += !blocked;
+		}
+	}
+	return unblocked;
+}
+
+// Flies diagonally across the world a few blocks above the ground, looking
+// along the path with some sway, and splits the chunks of every frame into
+// frustum culled, occluded and drawn
+void bench_occlusion(JobSystem *jobs, u32 *sizes, u32 num_sizes, u32 runs) {
+	Samples occlusion_samples = {};
+	u32 frames = 256;
+
+	printf("{\n  \"runs\": %u,\n  \"occlusion\": [\n", runs);
+	for (u32 s = 0; s < num_sizes; s++) {
+		num_x_chunks = sizes[s];
+		num_y_chunks = sizes[s];
+		num_chunks = num_x_chunks * num_y_chunks;
+
+		Chunk **chunks = (Chunk **)malloc(sizeof(Chunk *) * num_chunks);
+		build_world(jobs, chunks);
+
+		ChunkBounds bounds = create_chunk_bounds(num_chunks);
+		for (u32 i = 0; i < num_chunks; i++) {
+			set_chunk_bounds(&bounds, i, chunks[i]);
+		}
+		Horizon *horizon = create_horizon(num_chunks);
+		u8 *visible = (u8 *)malloc(num_chunks * 2);
+		u8 *frustum_visible = visible + num_chunks;
+
+		f32 world_w = (f32)(num_x_chunks * chunk_width);
+		f32 world_d = (f32)(num_y_chunks * chunk_depth);
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 5000.0f);
+		u64 in_frustum = 0;
+		u64 occluded = 0;
+		u64 unblocked = 0;
+
+		for (u32 r = 0; r < runs; r++) {
+			for (u32 f = 0; f < frames; f++) {
+				f32 t = (f + 0.5f) / frames;
+				f32 yaw = 0.785398f + 0.6f * sinf(t * 12.0f);
+				glm::vec3 pos = glm::vec3(t * world_w, 0.0f, t * world_d);
+				pos.y = world_height(chunks, (i32)pos.x, (i32)pos.z) + 4.0f;
+				glm::vec3 front = glm::vec3(cosf(yaw), -0.1f, sinf(yaw));
+				glm::mat4 pv = projection * glm::lookAt(pos, pos + front, glm::vec3(0.0f, 1.0f, 0.0f));
+
+				Frustum frustum = frustum_from_matrix(pv);
+				u32 n = cull_chunks(&bounds, &frustum, visible);
+				memcpy(frustum_visible, visible, num_chunks);
+
+				u64 start = get_time_ns();
+				u32 hidden = occlude_chunks(horizon, &bounds, pos, visible);
+				push_sample(&occlusion_samples, get_time_ns() - start);
+
+				if (r == 0) {
+					in_frustum += n;
+					occluded += hidden;
+
+					// Spot check that nothing occluded could have been seen
+					if (f % 16 == 0) {
+						for (u32 i = 0; i < num_chunks; i++) {
+							if (frustum_visible[i] && !visible[i]) {
+								unblocked += count_unblocked_columns(chunks, chunks[i], pos);
+							}
+						}
+					}
+				}
+			}
+		}
+
+		printf("    {\n");
+		printf("      \"num_chunks\": %u,\n", num_chunks);
+		printf("      \"avg_in_frustum\": %.1f,\n", (f64)in_frustum / frames);
+		printf("      \"avg_occluded\": %.1f,\n", (f64)occluded / frames);
+		printf("      \"occluded_fraction\": %.3f,\n", in_frustum ? (f64)occluded / in_frustum : 0.0);
+		printf("      \"unblocked_columns\": %lu,\n", unblocked);
+		printf("      \"pass\": {\n");
+		print_stats("occlude_chunks", &occlusion_samples, true);
+		printf("      }\n");
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+
+		free(visible);
+		free_horizon(horizon);
+		free_chunk_bounds(&bounds);
+		for (u32 i = 0; i < num_chunks; i++) {
+			free_chunk(chunks[i]);
+		}
+		free(chunks);
+	}
+	printf("  ]\n}\n");
+}
+
+// Triangles of the whole world seen from its centre, every chunk at full
+// resolution against every chunk at its distance level, as the world grows
+void bench_lod(JobSystem *jobs, u32 *sizes, u32 num_sizes, u32 runs) {
+	Samples lod_samples[MAX_LOD + 1] = {};
+
+	printf("{\n  \"runs\": %u,\n  \"lod_distance\": %.0f,\n  \"lod\": [\n", runs, lod_distance);
+	for (u32 s = 0; s < num_sizes; s++) {
+		num_x_chunks = sizes[s];
+		num_y_chunks = sizes[s];
+		num_chunks = num_x_chunks * num_y_chunks;
+
+		Chunk **chunks = (Chunk **)malloc(sizeof(Chunk *) * num_chunks);
+		build_world(jobs, chunks);
+
+		ChunkBounds bounds = create_chunk_bounds(num_chunks);
+		for (u32 i = 0; i < num_chunks; i++) {
+			set_chunk_bounds(&bounds, i, chunks[i]);
+		}
+
+		glm::vec3 camera = glm::vec3(num_x_chunks * chunk_width * 0.5f, 200.0f, num_y_chunks * chunk_depth * 0.5f);
+		u8 *levels = (u8 *)malloc(num_chunks);
+		memset(levels, 0, num_chunks);
+		while (update_chunk_lods(&bounds, camera, levels)) {
+		}
+
+		ChunkMesh mesh = {};
+		u64 full_triangles = 0;
+		u64 lod_triangles = 0;
+		u32 level_chunks[MAX_LOD + 1] = {};
+
+		for (u32 r = 0; r < runs; r++) {
+			for (u32 i = 0; i < num_chunks; i++) {
+				mesh_chunk(chunks, i, &mesh);
+				u64 full = mesh.num_indices / 3;
+
+				u64 start = get_time_ns();
+				if (levels[i] > 0) {
+					mesh_chunk_lod(chunks, i, levels[i], &mesh);
+				} else {
+					mesh_chunk(chunks, i, &mesh);
+				}
+				push_sample(&lod_samples[levels[i]], get_time_ns() - start);
+
+				if (r == 0) {
+					full_triangles += full;
+					lod_triangles += mesh.num_indices / 3;
+					level_chunks[levels[i]]++;
+				}
+			}
+		}
+
+		printf("    {\n");
+		printf("      \"num_chunks\": %u,\n", num_chunks);
+		printf("      \"chunks_per_level\": [%u, %u, %u, %u],\n", level_chunks[0], level_chunks[1], level_chunks[2], level_chunks[3]);
+		printf("      \"full_res_triangles\": %lu,\n", full_triangles);
+		printf("      \"lod_triangles\": %lu,\n", lod_triangles);
+		printf("      \"build\": {\n");
+		for (u32 l = 0; l <= MAX_LOD; l++) {
+			char name[32];
+			snprintf(name, sizeof(name), "level_%u", l);
+			print_stats(name, &lod_samples[l], l == MAX_LOD);
+		}
+		printf("      }\n");
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+
+		free_chunk_mesh(&mesh);
+		free(levels);
+		free_chunk_bounds(&bounds);
+		for (u32 i = 0; i < num_chunks; i++) {
+			free_chunk(chunks[i]);
+		}
+		free(chunks);
+	}
+	printf("  ]\n}\n");
+}
+
+// Builds the chunk at (cx, cz) with its eight neighbours in a scratch slot
+// grid of the same size and compares it with the streamed one
+bool streamed_chunk_matches(Chunk *streamed) {
+	i32 cx = streamed->x_off / (i32)chunk_width;
+	i32 cz = streamed->z_off / (i32)chunk_depth;
+
+	Chunk **scratch = (Chunk **)calloc(num_chunks, sizeof(Chunk *));
+	ChunkMap map = {};
+	chunk_map_reset(&map, 9);
+	for (i32 z = cz - 1; z <= cz + 1; z++) {
+		for (i32 x = cx - 1; x <= cx + 1; x++) {
+			scratch[chunk_slot(x, z)] = generate_chunk(x, z);
+			chunk_map_insert(&map, scratch[chunk_slot(x, z)]);
+		}
+	}
+	free_chunk_map(&map);
+
+	u32 slot = chunk_slot(cx, cz);
+	hull_chunk(scratch, slot);
+	update_chunk(scratch, slot);
+	bool match = chunks_match(streamed, scratch[slot]);
+
+	for (u32 i = 0; i < num_chunks; i++) {
+		if (scratch[i]) {
+			free_chunk(scratch[i]);
+		}
+	}
+	free(scratch);
+	return match;
+}
+
+// Flies out in a straight line at 4 blocks per frame and back again, one
+// update_chunk_stream per 60 Hz frame so workers get the time they would
+// between real frames, then waits for the stream to catch up and spot checks
+// the chunks. The way back reuses chunks still held by the chunk map.
+void bench_streaming(JobSystem *jobs, u32 *sizes, u32 num_sizes, u32 runs) {
+	Samples update_samples = {};
+	Samples latency_samples = {};
+	u32 frames = 180;
+	f32 speed = 4.0f;
+	u64 frame_ns = 1000 * 1000 * 1000 / 60;
+
+	printf("{\n  \"runs\": %u,\n  \"workers\": %u,\n  \"streaming\": [\n", runs, jobs->num_workers);
+	for (u32 s = 0; s < num_sizes; s++) {
+		u64 loaded = 0;
+		u64 unloaded = 0;
+		u64 reused = 0;
+		u64 evicted = 0;
+		u32 max_in_flight = 0;
+		u32 checked = 0;
+		u32 mismatched = 0;
+
+		for (u32 r = 0; r < runs; r++) {
+			ChunkStream *stream = create_chunk_stream(jobs, NULL, sizes[s]);
+			glm::vec3 camera = glm::vec3(0.0f, 200.0f, 0.0f);
+			fill_chunk_stream(stream, camera);
+
+			for (u32 f = 0; f < frames; f++) {
+				f32 dir = f < frames / 2 ? 1.0f : -1.0f;
+				camera += glm::vec3(speed * 0.8f, 0.0f, -speed * 0.6f) * dir;
+
+				StreamStats stats;
+				memset(&stats, 0, sizeof(stats));
+				u64 start = get_time_ns();
+				update_chunk_stream(stream, camera, &stats);
+				u64 elapsed = get_time_ns() - start;
+				push_sample(&update_samples, elapsed);
+				if (elapsed < frame_ns) {
+					std::this_thread::sleep_for(std::chrono::nanoseconds(frame_ns - elapsed));
+				}
+
+				if (stats.loaded) {
+					push_sample(&latency_samples, stats.latency_max_ns);
+				}
+				if (r == 0) {
+					loaded += stats.loaded;
+					unloaded += stats.unloaded;
+					reused += stats.reused;
+					evicted += stats.evicted;
+					max_in_flight = stats.in_flight > max_in_flight ? stats.in_flight : max_in_flight;
+				}
+			}
+
+			fill_chunk_stream(stream, camera);
+			if (r == 0) {
+				for (u32 i = 0; i < num_chunks; i += 7) {
+					if (chunk_ready(stream, i)) {
+						checked++;
+						mismatched += !streamed_chunk_matches(stream->chunks[i]);
+					}
+				}
+			}
+			free_chunk_stream(stream);
+		}
+
+		printf("    {\n");
+		printf("      \"radius\": %u,\n", sizes[s]);
+		printf("      \"slots\": %u,\n", num_chunks);
+		printf("      \"loaded\": %lu,\n", loaded);
+		printf("      \"unloaded\": %lu,\n", unloaded);
+		printf("      \"reused\": %lu,\n", reused);
+		printf("      \"evicted\": %lu,\n", evicted);
+		printf("      \"max_in_flight\": %u,\n", max_in_flight);
+		printf("      \"checked\": %u,\n", checked);
+		printf("      \"mismatched\": %u,\n", mismatched);
+		printf("      \"frame\": {\n");
+		print_stats("update_chunk_stream", &update_samples, false);
+		print_stats("max_latency", &latency_samples, true);
+		printf("      }\n");
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+	}
+	printf("  ]\n}\n");
+}
+
+// Cost per chunk lookup over bare chunks (no block data), random
+// coordinates and a random walk between neighbours, each with the flat
+// array's index arithmetic, the chunk map and the neighbour pointers
+void bench_lookup(u32 *sizes, u32 num_sizes, u32 runs) {
+	u32 num_queries = 1 << 20;
+	i32 *query_x = (i32 *)malloc(sizeof(i32) * num_queries);
+	i32 *query_z = (i32 *)malloc(sizeof(i32) * num_queries);
+	u8 *steps = (u8 *)malloc(num_queries);
+	u32 sides[4] = {FACE_FRONT, FACE_BACK, FACE_LEFT, FACE_RIGHT};
+
+	printf("{\n  \"runs\": %u,\n  \"queries\": %u,\n  \"lookup\": [\n", runs, num_queries);
+	for (u32 s = 0; s < num_sizes; s++) {
+		u32 n = sizes[s];
+		Chunk **flat = (Chunk **)malloc(sizeof(Chunk *) * n * n);
+		ChunkMap map = {};
+		chunk_map_reset(&map, n * n);
+		for (u32 i = 0; i < n * n; i++) {
+			flat[i] = (Chunk *)calloc(1, sizeof(Chunk));
+			flat[i]->x_off = (i32)((i % n) * chunk_width);
+			flat[i]->z_off = (i32)((i / n) * chunk_depth);
+			chunk_map_insert(&map, flat[i]);
+		}
+
+		srand(1);
+		for (u32 q = 0; q < num_queries; q++) {
+			query_x[q] = rand() % n;
+			query_z[q] = rand() % n;
+			steps[q] = sides[rand() % 4];
+		}
+
+		u64 flat_ns = ~0ul;
+		u64 map_ns = ~0ul;
+		u64 flat_walk_ns = ~0ul;
+		u64 neighbour_walk_ns = ~0ul;
+		i64 check = 0;
+
+		for (u32 r = 0; r < runs; r++) {
+			u64 start = get_time_ns();
+			for (u32 q = 0; q < num_queries; q++) {
+				check += flat[twod_to_oned(query_x[q], query_z[q], n)]->x_off;
+			}
+			u64 mid = get_time_ns();
+			for (u32 q = 0; q < num_queries; q++) {
+				check -= chunk_map_find(&map, query_x[q], query_z[q])->x_off;
+			}
+			u64 end = get_time_ns();
+			flat_ns = mid - start < flat_ns ? mid - start : flat_ns;
+			map_ns = end - mid < map_ns ? end - mid : map_ns;
+
+			// Walks stay put when a step would leave the world
+			i32 x = n / 2;
+			i32 z = n / 2;
+			start = get_time_ns();
+			for (u32 q = 0; q < num_queries; q++) {
+				i32 *d = face_normals[steps[q]];
+				i32 nx = x + d[0];
+				i32 nz = z + d[2];
+				if (nx >= 0 && nz >= 0 && nx < (i32)n && nz < (i32)n) {
+					x = nx;
+					z = nz;
+				}
+				check += flat[twod_to_oned(x, z, n)]->x_off;
+			}
+			mid = get_time_ns();
+			Chunk *chunk = flat[twod_to_oned(n / 2, n / 2, n)];
+			for (u32 q = 0; q < num_queries; q++) {
+				Chunk *next = chunk->neighbours[steps[q]];
+				chunk = next ? next : chunk;
+				check -= chunk->x_off;
+			}
+			end = get_time_ns();
+			flat_walk_ns = mid - start < flat_walk_ns ? mid - start : flat_walk_ns;
+			neighbour_walk_ns = end - mid < neighbour_walk_ns ? end - mid : neighbour_walk_ns;
+		}
+
+		printf("    {\n");
+		printf("      \"num_chunks\": %u,\n", n * n);
+		printf("      \"map_bytes\": %lu,\n", chunk_map_memory_usage(&map));
+		printf("      \"random_ns\": { \"flat\": %.2f, \"map\": %.2f },\n",
+			   (f64)flat_ns / num_queries, (f64)map_ns / num_queries);
+		printf("      \"walk_ns\": { \"flat\": %.2f, \"neighbours\": %.2f },\n",
+			   (f64)flat_walk_ns / num_queries, (f64)neighbour_walk_ns / num_queries);
+		printf("      \"results_agree\": %s\n", check == 0 ? "true" : "false");
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+
+		for (u32 i = 0; i < n * n; i++) {
+			free_chunk(flat[i]);
+		}
+		free_chunk_map(&map);
+		free(flat);
+	}
+	printf("  ]\n}\n");
+
+	free(query_x);
+	free(query_z);
+	free(steps);
+}
+
+// Checks an edited chunk against hull_chunk + update_chunk run on it from
+// scratch, which it is left with, and its face masks against the brute-force
+// check. Instances only have to match per face group as sets, and bounds
+// only have to contain the rebuilt ones.
+bool edited_chunk_matches(Chunk **chunks, u32 chunk_idx, Samples *rebuild_samples) {
+	Chunk *chunk = chunks[chunk_idx];
+	bool match = chunk->mappings.count == chunk->num_instances;
+	for (u32 f = 0; f < NUM_FACES && match; f++) {
+		for (u32 i = chunk->face_offsets[f]; i < chunk->face_offsets[f + 1] && match; i++) {
+			u32 idx;
+			Point p = unpack_instance(chunk->instances[i]);
+			match = cell_map_find(&chunk->mappings, face_key(point_to_oned(p, chunk_width, chunk_height), f), &idx) && idx == i;
+		}
+	}
+
+	u8 *pre_render_list = (u8 *)malloc(chunk_size * 2);
+	u8 *face_masks = pre_render_list + chunk_size;
+	u32 *instances = (u32 *)malloc(sizeof(u32) * (chunk->num_instances + 1));
+	u32 offsets[NUM_FACES + 1];
+	memcpy(pre_render_list, chunk->pre_render_list, chunk_size);
+	memcpy(face_masks, chunk->face_masks, chunk_size);
+	memcpy(instances, chunk->instances, sizeof(u32) * chunk->num_instances);
+	memcpy(offsets, chunk->face_offsets, sizeof(offsets));
+	u64 num_blocks = chunk->num_blocks;
+	u64 num_instances = chunk->num_instances;
+	u32 min_y = chunk->min_y;
+	u32 max_y = chunk->max_y;
+
+	u64 start = get_time_ns();
+	hull_chunk(chunks, chunk_idx);
+	update_chunk(chunks, chunk_idx);
+	push_sample(rebuild_samples, get_time_ns() - start);
+
+	match = match && num_blocks == chunk->num_blocks && num_instances == chunk->num_instances &&
+			!memcmp(offsets, chunk->face_offsets, sizeof(offsets)) &&
+			!memcmp(pre_render_list, chunk->pre_render_list, chunk_size) &&
+			!memcmp(face_masks, chunk->face_masks, chunk_size) &&
+			min_y <= chunk->min_y && max_y >= chunk->max_y;
+	for (u32 f = 0; f < NUM_FACES && match; f++) {
+		u32 first = offsets[f];
+		u32 count = offsets[f + 1] - first;
+		qsort(instances + first, count, sizeof(u32), compare_u32);
+		qsort(chunk->instances + first, count, sizeof(u32), compare_u32);
+		match = !memcmp(instances + first, chunk->instances + first, sizeof(u32) * count);
+	}
+
+	// Sorting moved the rebuilt instances away from their mappings
+	update_chunk(chunks, chunk_idx);
+	match = match && face_masks_match(chunks, chunk_idx);
+	free(pre_render_list);
+	free(instances);
+	return match;
+}
+
+// Random edits across a size x size world, removing and adding blocks at
+// column tops and now and then a few cells below or above them, which
+// leaves holes and floating blocks, with chunk borders as likely as
+// anywhere else. Each edit is timed, and after every round of edits every
+// chunk is checked against a full rebuild, which is timed per chunk.
+void bench_edits(JobSystem *jobs, u32 *sizes, u32 num_sizes, u32 runs) {
+	Samples edit_samples = {};
+	Samples rebuild_samples = {};
+	u32 edits_per_round = 500;
+
+	printf("{\n  \"runs\": %u,\n  \"edits\": [\n", runs);
+	for (u32 s = 0; s < num_sizes; s++) {
+		num_x_chunks = sizes[s];
+		num_y_chunks = sizes[s];
+		num_chunks = num_x_chunks * num_y_chunks;
+
+		Chunk **chunks = (Chunk **)malloc(sizeof(Chunk *) * num_chunks);
+		build_world(jobs, chunks);
+
+		srand(1);
+		u32 edits = 0;
+		u32 checked = 0;
+		u32 mismatched = 0;
+		for (u32 r = 0; r < runs; r++) {
+			for (u32 e = 0; e < edits_per_round; e++) {
+				Chunk *chunk = chunks[rand() % num_chunks];
+				u32 x = rand() % chunk_width;
+				u32 z = rand() % chunk_depth;
+				u32 h = chunk->real_blocks[twod_to_oned(x, z, chunk_width)];
+				u32 depth = rand() % 4 == 0 ? rand() % 4 : 0;
+				bool solid = rand() % 2;
+				u32 y = solid ? h + 1 + depth : (h > depth ? h - depth : 0);
+
+				u64 start = get_time_ns();
+				bool edited = set_block(chunk, x, y, z, solid);
+				u64 elapsed = get_time_ns() - start;
+				if (edited) {
+					push_sample(&edit_samples, elapsed);
+					edits++;
+				}
+			}
+
+			for (u32 i = 0; i < num_chunks; i++) {
+				checked++;
+				mismatched += !edited_chunk_matches(chunks, i, &rebuild_samples);
+			}
+		}
+
+		printf("    {\n");
+		printf("      \"num_chunks\": %u,\n", num_chunks);
+		printf("      \"edits\": %u,\n", edits);
+		printf("      \"checked\": %u,\n", checked);
+		printf("      \"mismatched\": %u,\n", mismatched);
+		printf("      \"stages\": {\n");
+		print_stats("set_block", &edit_samples, false);
+		print_stats("hull_chunk + update_chunk", &rebuild_samples, true);
+		printf("      }\n");
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+
+		for (u32 i = 0; i < num_chunks; i++) {
+			free_chunk(chunks[i]);
+		}
+		free(chunks);
+	}
+	printf("  ]\n}\n");
+}
+
+// Plain Amanatides & Woo stepping through every cell, looking each one up,
+// to check raycast's skipping against
+RayHit raycast_reference(Chunk **chunks, glm::vec3 origin, glm::vec3 dir, f32 max_distance) {
+	RayHit result = {};
+	glm::ivec3 cell = glm::ivec3((i32)floorf(origin.x), (i32)floorf(origin.y), (i32)floorf(origin.z));
+	glm::ivec3 step;
+	glm::vec3 t_max;
+	glm::vec3 t_delta;
+	for (i32 a = 0; a < 3; a++) {
+		step[a] = dir[a] > 0.0f ? 1 : (dir[a] < 0.0f ? -1 : 0);
+		t_delta[a] = step[a] ? fabsf(1.0f / dir[a]) : INFINITY;
+		t_max[a] = step[a] ? ((f32)(cell[a] + (step[a] > 0 ? 1 : 0)) - origin[a]) / dir[a] : INFINITY;
+	}
+
+	Face face = dir.y < 0.0f ? FACE_TOP : FACE_BOTTOM;
+	f32 t = 0.0f;
+	while (t <= max_distance && cell.y >= 0) {
+		Chunk *chunk = find_chunk(chunks, floor_div(cell.x, chunk_width), floor_div(cell.z, chunk_depth));
+		if (chunk && chunk_block_solid(chunk, cell.x - chunk->x_off, cell.y, cell.z - chunk->z_off)) {
+			result.hit = true;
+			result.block = cell;
+			result.face = face;
+			result.distance = t;
+			return result;
+		}
+
+		i32 axis = 0;
+		if (t_max.y < t_max[axis]) {
+			axis = 1;
+		}
+		if (t_max.z < t_max[axis]) {
+			axis = 2;
+		}
+		t = t_max[axis];
+		cell[axis] += step[axis];
+		t_max[axis] += t_delta[axis];
+		face = ray_entry_faces[axis][step[axis] < 0];
+	}
+	return result;
+}
+
+// Rays per second at several ray lengths, from random points a little above
+// the terrain in random directions, through raycast on one thread and on
+// the job system, and through the reference stepping it is checked against
+void bench_raycast(JobSystem *jobs, u32 *sizes, u32 num_sizes, u32 runs) {
+	u32 num_rays = 1 << 16;
+	f32 lengths[] = {16.0f, 64.0f, 256.0f};
+	u32 num_lengths = sizeof(lengths) / sizeof(lengths[0]);
+
+	RayBatch batch;
+	batch.origins = (glm::vec3 *)malloc(sizeof(glm::vec3) * num_rays);
+	batch.directions = (glm::vec3 *)malloc(sizeof(glm::vec3) * num_rays);
+	batch.hits = (RayHit *)malloc(sizeof(RayHit) * num_rays);
+	batch.count = num_rays;
+	RayHit *reference = (RayHit *)malloc(sizeof(RayHit) * num_rays);
+
+	printf("{\n  \"runs\": %u,\n  \"workers\": %u,\n  \"rays\": %u,\n  \"raycast\": [\n", runs, jobs->num_workers, num_rays);
+	for (u32 s = 0; s < num_sizes; s++) {
+		num_x_chunks = sizes[s];
+		num_y_chunks = sizes[s];
+		num_chunks = num_x_chunks * num_y_chunks;
+
+		Chunk **chunks = (Chunk **)malloc(sizeof(Chunk *) * num_chunks);
+		build_world(jobs, chunks);
+		batch.chunks = chunks;
+
+		srand(1);
+		f32 world_x = (f32)(num_x_chunks * chunk_width);
+		f32 world_z = (f32)(num_y_chunks * chunk_depth);
+		for (u32 i = 0; i < num_rays; i++) {
+			f32 x = world_x * (f32)rand() / (f32)RAND_MAX;
+			f32 z = world_z * (f32)rand() / (f32)RAND_MAX;
+			f32 ground = (f32)world_height(chunks, (i32)x, (i32)z);
+			batch.origins[i] = glm::vec3(x, ground + 1.5f + 30.0f * (f32)rand() / (f32)RAND_MAX, z);
+
+			glm::vec3 d;
+			do {
+				d = glm::vec3((f32)rand() / RAND_MAX * 2.0f - 1.0f, (f32)rand() / RAND_MAX * 2.0f - 1.0f, (f32)rand() / RAND_MAX * 2.0f - 1.0f);
+			} while (glm::length(d) < 0.1f || glm::length(d) > 1.0f);
+			batch.directions[i] = glm::normalize(d);
+		}
+
+		printf("    {\n      \"num_chunks\": %u,\n      \"lengths\": [\n", num_chunks);
+		for (u32 l = 0; l < num_lengths; l++) {
+			batch.max_distance = lengths[l];
+			u64 serial_ns = ~0ul;
+			u64 parallel_ns = ~0ul;
+			u64 reference_ns = ~0ul;
+
+			for (u32 r = 0; r < runs; r++) {
+				u64 start = get_time_ns();
+				raycast_batch(&batch, 0, num_rays);
+				u64 mid = get_time_ns();
+				raycast_batch_parallel(jobs, &batch);
+				u64 end = get_time_ns();
+				serial_ns = mid - start < serial_ns ? mid - start : serial_ns;
+				parallel_ns = end - mid < parallel_ns ? end - mid : parallel_ns;
+
+				start = get_time_ns();
+				for (u32 i = 0; i < num_rays; i++) {
+					reference[i] = raycast_reference(chunks, batch.origins[i], batch.directions[i], batch.max_distance);
+				}
+				end = get_time_ns();
+				reference_ns = end - start < reference_ns ? end - start : reference_ns;
+			}
+
+			u32 hits = 0;
+			u32 mismatched = 0;
+			for (u32 i = 0; i < num_rays; i++) {
+				RayHit *a = &batch.hits[i];
+				RayHit *b = &reference[i];
+				hits += a->hit;
+				mismatched += a->hit != b->hit || (a->hit && (a->block.x != b->block.x || a->block.y != b->block.y ||
+															  a->block.z != b->block.z || a->face != b->face));
+			}
+
+			printf("        { \"length\": %.0f, \"hit_fraction\": %.3f, \"mismatched\": %u, ", lengths[l], (f64)hits / num_rays, mismatched);
+			printf("\"rays_per_sec\": { \"raycast\": %.0f, \"parallel\": %.0f, \"reference\": %.0f } }%s\n",
+				   num_rays / ((f64)serial_ns / 1e9), num_rays / ((f64)parallel_ns / 1e9), num_rays / ((f64)reference_ns / 1e9),
+				   l + 1 < num_lengths ? "," : "");
+		}
+		printf("      ]\n    }%s\n", s + 1 < num_sizes ? "," : "");
+
+		for (u32 i = 0; i < num_chunks; i++) {
+			free_chunk(chunks[i]);
+		}
+		free(chunks);
+	}
+	printf("  ]\n}\n");
+
+	free(batch.origins);
+	free(batch.directions);
+	free(batch.hits);
+	free(reference);
+}
+
+// Cell lookup for the ambient occlusion check: like chunk_block_solid, but
+// outside the loaded world is air
+bool ao_block_solid(Chunk *chunk, i32 x, i32 y, i32 z) {
+	if (y < 0) {
+		return true;
+	}
+	if (y >= (i32)chunk_height) {
+		return false;
+	}
+	chunk = column_chunk(chunk, &x, &z);
+	return chunk && column_solid(chunk_column(chunk, x, z), y);
+}
+
+// Brute-force check of the ambient occlusion in every instance, counting the
+// three cells at each corner one at a time
+bool ao_matches(Chunk **chunks, u32 chunk_idx) {
+	Chunk *chunk = chunks[chunk_idx];
+	for (u32 f = 0; f < NUM_FACES; f++) {
+		i32 *n = face_normals[f];
+		for (u32 i = chunk->face_offsets[f]; i < chunk->face_offsets[f + 1]; i++) {
+			Point p = unpack_instance(chunk->instances[i]);
+			u8 expected = 0;
+			for (u32 k = 0; k < 4; k++) {
+				i32 d[3] = {0, 0, 0};
+				i32 side_axes[2];
+				u32 num_axes = 0;
+				for (u32 a = 0; a < 3; a++) {
+					if (n[a] == 0) {
+						d[a] = face_corners[f][k][a] > 0.0f ? 1 : -1;
+						side_axes[num_axes++] = a;
+					}
+				}
+
+				i32 front[3] = {(i32)p.x + n[0], (i32)p.y + n[1], (i32)p.z + n[2]};
+				i32 s1[3] = {front[0], front[1], front[2]};
+				i32 s2[3] = {front[0], front[1], front[2]};
+				s1[side_axes[0]] += d[side_axes[0]];
+				s2[side_axes[1]] += d[side_axes[1]];
+				bool a = ao_block_solid(chunk, s1[0], s1[1], s1[2]);
+				bool b = ao_block_solid(chunk, s2[0], s2[1], s2[2]);
+				bool c = ao_block_solid(chunk, front[0] + d[0], front[1] + d[1], front[2] + d[2]);
+				u8 level = a && b ? 0 : 3 - (a + b + c);
+				expected |= level << (2 * k);
+			}
+			if (chunk->instances[i] >> 24 != expected) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Per-chunk cost of ambient occlusion: generate_chunk, hull_chunk and
+// update_chunk with and without it, then mesh_chunk on the result of each.
+// The share is the extra update_chunk time over the whole build with it.
+// The last build of each chunk is checked against the brute-force version.
+void bench_ao(JobSystem *jobs, u32 *sizes, u32 num_sizes, u32 runs) {
+	Samples gen_samples = {};
+	Samples hull_samples = {};
+	Samples plain_samples = {};
+	Samples ao_samples = {};
+	Samples plain_mesh_samples = {};
+	Samples ao_mesh_samples = {};
+
+	printf("{\n  \"runs\": %u,\n  \"ambient_occlusion\": [\n", runs);
+	for (u32 s = 0; s < num_sizes; s++) {
+		num_x_chunks = sizes[s];
+		num_y_chunks = sizes[s];
+		num_chunks = num_x_chunks * num_y_chunks;
+
+		Chunk **chunks = (Chunk **)malloc(sizeof(Chunk *) * num_chunks);
+		build_world(jobs, chunks);
+
+		ChunkMesh mesh = {};
+		u64 build_ns = 0;
+		u64 ao_ns = 0;
+		u64 plain_triangles = 0;
+		u64 ao_triangles = 0;
+		bool match = true;
+
+		for (u32 r = 0; r < runs; r++) {
+			for (u32 i = 0; i < num_chunks; i++) {
+				Point cp = oned_to_twod(i, num_x_chunks);
+				u64 start = get_time_ns();
+				Chunk *scratch = generate_chunk(cp.x, cp.y);
+				u64 gen_ns = get_time_ns() - start;
+				free_chunk(scratch);
+
+				start = get_time_ns();
+				hull_chunk(chunks, i);
+				u64 hull_ns = get_time_ns() - start;
+
+				ambient_occlusion = false;
+				start = get_time_ns();
+				update_chunk(chunks, i);
+				u64 plain_ns = get_time_ns() - start;
+				start = get_time_ns();
+				mesh_chunk(chunks, i, &mesh);
+				push_sample(&plain_mesh_samples, get_time_ns() - start);
+				u64 plain_mesh_triangles = mesh.num_indices / 3;
+
+				ambient_occlusion = true;
+				start = get_time_ns();
+				update_chunk(chunks, i);
+				u64 update_ns = get_time_ns() - start;
+				start = get_time_ns();
+				mesh_chunk(chunks, i, &mesh);
+				push_sample(&ao_mesh_samples, get_time_ns() - start);
+
+				push_sample(&gen_samples, gen_ns);
+				push_sample(&hull_samples, hull_ns);
+				push_sample(&plain_samples, plain_ns);
+				push_sample(&ao_samples, update_ns);
+				build_ns += gen_ns + hull_ns + update_ns;
+				ao_ns += update_ns > plain_ns ? update_ns - plain_ns : 0;
+
+				if (r == 0) {
+					plain_triangles += plain_mesh_triangles;
+					ao_triangles += mesh.num_indices / 3;
+					match = match && ao_matches(chunks, i);
+				}
+			}
+		}
+
+		printf("    {\n");
+		printf("      \"num_chunks\": %u,\n", num_chunks);
+		printf("      \"ao_matches\": %s,\n", match ? "true" : "false");
+		printf("      \"ao_share_of_build\": %.3f,\n", build_ns ? (f64)ao_ns / (f64)build_ns : 0.0);
+		printf("      \"mesh_triangles\": { \"without_ao\": %lu, \"with_ao\": %lu },\n", plain_triangles, ao_triangles);
+		printf("      \"build\": {\n");
+		print_stats("generate_chunk", &gen_samples, false);
+		print_stats("hull_chunk", &hull_samples, false);
+		print_stats("update_chunk_without_ao", &plain_samples, false);
+		print_stats("update_chunk_with_ao", &ao_samples, false);
+		print_stats("mesh_chunk_without_ao", &plain_mesh_samples, false);
+		print_stats("mesh_chunk_with_ao", &ao_mesh_samples, true);
+		printf("      }\n");
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+
+		free_chunk_mesh(&mesh);
+		for (u32 i = 0; i < num_chunks; i++) {
+			free_chunk(chunks[i]);
+		}
+		free(chunks);
+	}
+	printf("  ]\n}\n");
+}
+
+// Flushes a world's region files and asks the kernel to drop them from the
+// page cache, returns false where that is not supported
+bool drop_region_files(RegionStore *store, u32 n, bool remove) {
+	bool dropped = true;
+	i32 last = region_coord((i32)n - 1);
+	for (i32 rz = 0; rz <= last; rz++) {
+		for (i32 rx = 0; rx <= last; rx++) {
+			char path[512];
+			region_path(store, rx, rz, path, sizeof(path));
+			if (remove) {
+				unlink(path);
+				continue;
+			}
+
+			i32 fd = open(path, O_RDONLY);
+			if (fd < 0) {
+				continue;
+			}
+			fsync(fd);
+#ifdef POSIX_FADV_DONTNEED
+			dropped = dropped && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+#else
+			dropped = false;
+#endif
+			close(fd);
+		}
+	}
+	return dropped;
+}
+
+// Time to bring a size x size world's chunks into memory ready for hulling:
+// generating them, against loading them from region files straight after
+// dropping the files from the page cache (cold) and again with the files
+// cached (warm). Every load is checked against the generated heightmaps.
+void bench_regions(u32 *sizes, u32 num_sizes, u32 runs) {
+	Samples generate_samples = {};
+	Samples save_samples = {};
+	Samples cold_samples = {};
+	Samples warm_samples = {};
+
+	char dir[] = "/tmp/voxel_bench_XXXXXX";
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "could not create a directory for region files\n");
+		return;
+	}
+
+	printf("{\n  \"runs\": %u,\n  \"regions\": [\n", runs);
+	for (u32 s = 0; s < num_sizes; s++) {
+		u32 n = sizes[s];
+		u32 count = n * n;
+		Chunk **chunks = (Chunk **)calloc(count, sizeof(Chunk *));
+		u8 *heights = (u8 *)malloc(count * chunk_width * chunk_depth);
+		u32 words = chunk_width * chunk_depth * COLUMN_WORDS;
+		u64 *occupancy = (u64 *)malloc(sizeof(u64) * count * words);
+		u32 mismatched = 0;
+		u32 missing = 0;
+		bool cold = true;
+
+		for (u32 r = 0; r < runs; r++) {
+			u64 start = get_time_ns();
+			for (u32 i = 0; i < count; i++) {
+				chunks[i] = generate_chunk(i % n, i / n);
+			}
+			push_sample(&generate_samples, get_time_ns() - start);
+
+			for (u32 i = 0; i < count; i++) {
+				memcpy(heights + i * chunk_width * chunk_depth, chunks[i]->real_blocks, chunk_width * chunk_depth);
+				memcpy(occupancy + i * words, chunks[i]->occupancy, sizeof(u64) * words);
+				free_chunk(chunks[i]);
+			}
+		}
+
+		RegionStore *store = create_region_store(dir);
+		u64 bytes_written = 0;
+		for (u32 r = 0; r < runs; r++) {
+			drop_region_files(store, n, true);
+			free_region_store(store);
+			store = create_region_store(dir);
+
+			for (u32 i = 0; i < count; i++) {
+				chunks[i] = new_chunk(i % n, i / n);
+				memcpy(chunks[i]->real_blocks, heights + i * chunk_width * chunk_depth, chunk_width * chunk_depth);
+				memcpy(chunks[i]->occupancy, occupancy + i * words, sizeof(u64) * words);
+			}
+			u64 start = get_time_ns();
+			for (u32 i = 0; i < count; i++) {
+				save_region_chunk(store, chunks[i]);
+			}
+			push_sample(&save_samples, get_time_ns() - start);
+
+			for (u32 i = 0; i < count; i++) {
+				free_chunk(chunks[i]);
+			}
+			bytes_written = store->bytes_written;
+		}
+		free_region_store(store);
+
+		for (u32 pass = 0; pass < 2; pass++) {
+			for (u32 r = 0; r < runs; r++) {
+				store = create_region_store(dir);
+				if (pass == 0) {
+					cold = drop_region_files(store, n, false) && cold;
+				}
+
+				u64 start = get_time_ns();
+				for (u32 i = 0; i < count; i++) {
+					chunks[i] = load_region_chunk(store, i % n, i / n);
+				}
+				push_sample(pass == 0 ? &cold_samples : &warm_samples, get_time_ns() - start);
+
+				for (u32 i = 0; i < count; i++) {
+					if (!chunks[i]) {
+						missing++;
+						continue;
+					}
+					mismatched += memcmp(chunks[i]->real_blocks, heights + i * chunk_width * chunk_depth, chunk_width * chunk_depth) != 0 ||
+								  memcmp(chunks[i]->occupancy, occupancy + i * words, sizeof(u64) * words) != 0;
+					free_chunk(chunks[i]);
+				}
+				free_region_store(store);
+			}
+		}
+
+		store = create_region_store(dir);
+		drop_region_files(store, n, true);
+		free_region_store(store);
+
+		printf("    {\n");
+		printf("      \"num_chunks\": %u,\n", count);
+		printf("      \"record_bytes_per_chunk\": %.1f,\n", (f64)bytes_written / count);
+		printf("      \"raw_bytes_per_chunk\": %u,\n", chunk_size);
+		printf("      \"cold_cache_dropped\": %s,\n", cold ? "true" : "false");
+		printf("      \"missing\": %u,\n", missing);
+		printf("      \"mismatched\": %u,\n", mismatched);
+		printf("      \"world\": {\n");
+		print_stats("generate", &generate_samples, false);
+		print_stats("save", &save_samples, false);
+		print_stats("load_cold", &cold_samples, false);
+		print_stats("load_warm", &warm_samples, true);
+		printf("      }\n");
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+
+		free(heights);
+		free(occupancy);
+		free(chunks);
+	}
+	printf("  ]\n}\n");
+
+	rmdir(dir);
+}
+
+// The heightmap writer this replaced: the world gathered into one image,
+// expanded to 32-bit colour and written with stdio's default buffering
+bool write_bitmap_baseline(const char *filename, Chunk **chunks, u32 n) {
+	u32 width = n * chunk_width;
+	u32 height = n * chunk_depth;
+	u8 *heights = (u8 *)malloc(width * height);
+	for (u32 z = 0; z < height; z++) {
+		for (u32 cx = 0; cx < n; cx++) {
+			Chunk *chunk = chunks[twod_to_oned(cx, z / chunk_depth, n)];
+			memcpy(heights + z * width + cx * chunk_width, chunk->real_blocks + twod_to_oned(0, z % chunk_depth, chunk_width), chunk_width);
+		}
+	}
+	Color *bitmap = (Color *)malloc(width * height * sizeof(Color));
+	for (u32 i = 0; i < width * height; i++) {
+		bitmap[i] = rgb_to_color(heights[i], heights[i], heights[i]);
+	}
+
+	FILE *file = fopen(filename, "wb");
+	bool written = file != NULL;
+	if (file) {
+		u8 header[TGA_HEADER_SIZE] = {};
+		header[2] = TGA_TRUE_COLOR;
+		header[12] = width & 0xff;
+		header[13] = width >> 8;
+		header[14] = height & 0xff;
+		header[15] = height >> 8;
+		header[16] = 32;
+		header[17] = TGA_TOP_DOWN;
+		fwrite(header, 1, sizeof(header), file);
+		fwrite(bitmap, 1, width * height * sizeof(Color), file);
+		written = fclose(file) == 0;
+	}
+	free(bitmap);
+	free(heights);
+	return written;
+}
+
+u64 file_size(const char *filename) {
+	FILE *file = fopen(filename, "rb");
+	if (!file) {
+		return 0;
+	}
+	fseek(file, 0, SEEK_END);
+	u64 size = (u64)ftell(file);
+	fclose(file);
+	return size;
+}
+
+// Writing a size x size world's heightmap as TGA: the old 32-bit bitmap
+// path against streaming it out of the chunks as greyscale, uncompressed
+// and run-length encoded, then reading each back. A colour image made from
+// the heights checks the 3 and 4 byte RLE paths the same way.
+void bench_tga(u32 *sizes, u32 num_sizes, u32 runs) {
+	Samples bitmap_samples = {};
+	Samples grey_samples = {};
+	Samples rle_samples = {};
+	Samples read_samples = {};
+	Samples read_rle_samples = {};
+
+	char dir[] = "/tmp/voxel_bench_XXXXXX";
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "could not create a directory for TGA files\n");
+		return;
+	}
+	char bitmap_path[256];
+	char grey_path[256];
+	char rle_path[256];
+	char color_path[256];
+	snprintf(bitmap_path, sizeof(bitmap_path), "%s/bitmap.tga", dir);
+	snprintf(grey_path, sizeof(grey_path), "%s/grey.tga", dir);
+	snprintf(rle_path, sizeof(rle_path), "%s/rle.tga", dir);
+	snprintf(color_path, sizeof(color_path), "%s/color.tga", dir);
+
+	printf("{\n  \"runs\": %u,\n  \"tga\": [\n", runs);
+	for (u32 s = 0; s < num_sizes; s++) {
+		u32 n = sizes[s];
+		num_x_chunks = n;
+		num_y_chunks = n;
+		num_chunks = n * n;
+		Chunk **chunks = (Chunk **)calloc(num_chunks, sizeof(Chunk *));
+		for (u32 i = 0; i < num_chunks; i++) {
+			chunks[i] = generate_chunk(i % n, i / n);
+		}
+		u32 width = n * chunk_width;
+		u32 height = n * chunk_depth;
+		u32 failures = 0;
+		u32 mismatched = 0;
+
+		for (u32 r = 0; r < runs; r++) {
+			u64 start = get_time_ns();
+			failures += !write_bitmap_baseline(bitmap_path, chunks, n);
+			push_sample(&bitmap_samples, get_time_ns() - start);
+
+			start = get_time_ns();
+			failures += !write_heightmap_tga(grey_path, chunks, false);
+			push_sample(&grey_samples, get_time_ns() - start);
+
+			start = get_time_ns();
+			failures += !write_heightmap_tga(rle_path, chunks, true);
+			push_sample(&rle_samples, get_time_ns() - start);
+
+			for (u32 pass = 0; pass < 2; pass++) {
+				Image img;
+				start = get_time_ns();
+				if (!read_tga(pass == 0 ? grey_path : rle_path, &img)) {
+					failures++;
+					continue;
+				}
+				push_sample(pass == 0 ? &read_samples : &read_rle_samples, get_time_ns() - start);
+
+				// The file is top down, the image bottom up
+				bool same = img.width == width && img.height == height && img.bytes_per_pixel == 1;
+				for (u32 z = 0; same && z < height; z++) {
+					Chunk *chunk = chunks[twod_to_oned(0, z / chunk_depth, n)];
+					for (u32 cx = 0; same && cx < n; cx++, chunk = chunks[twod_to_oned(cx, z / chunk_depth, n)]) {
+						same = !memcmp(img.data + (height - 1 - z) * width + cx * chunk_width,
+									   chunk->real_blocks + twod_to_oned(0, z % chunk_depth, chunk_width), chunk_width);
+					}
+				}
+				mismatched += !same;
+				free(img.data);
+			}
+		}
+
+		// Colour pixels with long runs, varied ones and the odd lone pixel
+		for (u8 bpp = 3; bpp <= 4; bpp++) {
+			Image color;
+			color.width = width;
+			color.height = height;
+			color.bytes_per_pixel = bpp;
+			color.data = (u8 *)malloc(width * height * bpp);
+			for (u32 i = 0; i < width * height; i++) {
+				u8 h = chunks[twod_to_oned(i % width / chunk_width, i / width / chunk_depth, n)]->real_blocks[twod_to_oned(i % chunk_width, i / width % chunk_depth, chunk_width)];
+				u8 *p = color.data + i * bpp;
+				p[0] = h;
+				p[1] = h / 8;
+				p[2] = i % 97 == 0 ? 255 : 0;
+				if (bpp == 4) {
+					p[3] = 255;
+				}
+			}
+			Image back;
+			if (!write_tga(color_path, &color, true) || !read_tga(color_path, &back)) {
+				failures++;
+			} else {
+				mismatched += back.bytes_per_pixel != bpp || memcmp(back.data, color.data, width * height * bpp) != 0;
+				free(back.data);
+			}
+			free(color.data);
+		}
+
+		printf("    {\n");
+		printf("      \"num_chunks\": %u,\n", num_chunks);
+		printf("      \"width\": %u,\n", width);
+		printf("      \"height\": %u,\n", height);
+		printf("      \"bitmap_bytes\": %lu,\n", file_size(bitmap_path));
+		printf("      \"grey_bytes\": %lu,\n", file_size(grey_path));
+		printf("      \"rle_bytes\": %lu,\n", file_size(rle_path));
+		printf("      \"failures\": %u,\n", failures);
+		printf("      \"mismatched\": %u,\n", mismatched);
+		printf("      \"heightmap\": {\n");
+		print_stats("write_bitmap", &bitmap_samples, false);
+		print_stats("write_grey", &grey_samples, false);
+		print_stats("write_rle", &rle_samples, false);
+		print_stats("read_grey", &read_samples, false);
+		print_stats("read_rle", &read_rle_samples, true);
+		printf("      }\n");
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+
+		for (u32 i = 0; i < num_chunks; i++) {
+			free_chunk(chunks[i]);
+		}
+		free(chunks);
+	}
+	printf("  ]\n}\n");
+
+	unlink(bitmap_path);
+	unlink(grey_path);
+	unlink(rle_path);
+	unlink(color_path);
+	rmdir(dir);
+}
+
+// Set by -x, written once the run is over whichever mode it was
+const char *trace_path = NULL;
+
+void write_bench_trace() {
+	trace_stop();
+	if (!write_chrome_trace(trace_path)) {
+		fprintf(stderr, "could not write trace to %s\n", trace_path);
+	}
+}
+
+u32 *parse_sizes(char *arg, u32 *num_sizes) {
+	u32 *sizes = (u32 *)malloc(sizeof(u32) * (strlen(arg) + 1));
+	*num_sizes = 0;
+	for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		u32 size = (u32)atoi(tok);
+		if (size > 0) {
+			sizes[(*num_sizes)++] = size;
+		}
+	}
+	return sizes;
+}
+
+int main(int argc, char **argv) {
+	u32 runs = 5;
+	u32 default_sizes[] = {3, 9, 17, 33};
+	u32 *sizes = default_sizes;
+	u32 num_sizes = 4;
+	u32 num_workers = 0;
+	u32 perlin_samples = 0;
+	bool mesher = false;
+	bool culling = false;
+	bool occlusion = false;
+	bool lod = false;
+	bool streaming = false;
+	bool lookup = false;
+	bool regions = false;
+	bool edits = false;
+	bool rays = false;
+	bool ao = false;
+	bool tga = false;
+
+	for (i32 i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			runs = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			sizes = parse_sizes(argv[++i], &num_sizes);
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			num_workers = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			perlin_samples = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-m")) {
+			mesher = true;
+		} else if (!strcmp(argv[i], "-c")) {
+			culling = true;
+		} else if (!strcmp(argv[i], "-o")) {
+			occlusion = true;
+		} else if (!strcmp(argv[i], "-l")) {
+			lod = true;
+		} else if (!strcmp(argv[i], "-t")) {
+			streaming = true;
+		} else if (!strcmp(argv[i], "-k")) {
+			lookup = true;
+		} else if (!strcmp(argv[i], "-d")) {
+			regions = true;
+		} else if (!strcmp(argv[i], "-e")) {
+			edits = true;
+		} else if (!strcmp(argv[i], "-y")) {
+			rays = true;
+		} else if (!strcmp(argv[i], "-a")) {
+			ao = true;
+		} else if (!strcmp(argv[i], "-i")) {
+			tga = true;
+		} else if (!strcmp(argv[i], "-x") && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [-r runs] [-s size[,size...]] [-j workers] [-p samples] [-m] [-c] [-o] [-l] [-t] [-k] [-d] [-e] [-y] [-a] [-i] [-x trace.json]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (trace_path) {
+		trace_name_thread("main");
+		trace_start();
+		atexit(write_bench_trace);
+	}
+
+	if (lookup) {
+		bench_lookup(sizes, num_sizes, runs);
+		return 0;
+	}
+
+	if (regions) {
+		bench_regions(sizes, num_sizes, runs);
+		return 0;
+	}
+
+	if (tga) {
+		bench_tga(sizes, num_sizes, runs);
+		return 0;
+	}
+
+	if (perlin_samples) {
+		bench_perlin(perlin_samples, runs);
+		return 0;
+	}
+
+	if (culling) {
+		bench_culling(sizes, num_sizes, runs);
+		return 0;
+	}
+
+	Samples gen_samples = {};
+	Samples hull_samples = {};
+	Samples update_samples = {};
+	Samples world_samples = {};
+	Samples parallel_samples = {};
+
+	JobSystem *jobs = create_job_system(num_workers);
+
+	if (streaming) {
+		bench_streaming(jobs, sizes, num_sizes, runs);
+		destroy_job_system(jobs);
+		return 0;
+	}
+
+	if (rays) {
+		bench_raycast(jobs, sizes, num_sizes, runs);
+		destroy_job_system(jobs);
+		return 0;
+	}
+
+	if (edits) {
+		bench_edits(jobs, sizes, num_sizes, runs);
+		destroy_job_system(jobs);
+		return 0;
+	}
+
+	if (ao) {
+		bench_ao(jobs, sizes, num_sizes, runs);
+		destroy_job_system(jobs);
+		return 0;
+	}
+
+	if (lod) {
+		bench_lod(jobs, sizes, num_sizes, runs);
+		destroy_job_system(jobs);
+		return 0;
+	}
+
+	if (occlusion) {
+		bench_occlusion(jobs, sizes, num_sizes, runs);
+		destroy_job_system(jobs);
+		return 0;
+	}
+
+	if (mesher) {
+		bench_mesher(jobs, sizes, num_sizes, runs);
+		destroy_job_system(jobs);
+		return 0;
+	}
+
+	printf("{\n  \"runs\": %u,\n  \"workers\": %u,\n  \"results\": [\n", runs, jobs->num_workers);
+	for (u32 s = 0; s < num_sizes; s++) {
+		num_x_chunks = sizes[s];
+		num_y_chunks = sizes[s];
+		num_chunks = num_x_chunks * num_y_chunks;
+
+		Chunk **chunks = (Chunk **)malloc(sizeof(Chunk *) * num_chunks);
+		u64 block_load = 0;
+		u64 world_bytes = 0;
+		u64 total_ns = 0;
+
+		for (u32 r = 0; r < runs; r++) {
+			u64 world_start = get_time_ns();
+			ChunkMap map = {};
+			chunk_map_reset(&map, num_chunks);
+
+			for (u32 x = 0; x < num_x_chunks; x++) {
+				for (u32 y = 0; y < num_y_chunks; y++) {
+					u64 start = get_time_ns();
+					Chunk *chunk = generate_chunk(x, y);
+					push_sample(&gen_samples, get_time_ns() - start);
+
+					chunks[twod_to_oned(x, y, num_x_chunks)] = chunk;
+					chunk_map_insert(&map, chunk);
+				}
+			}
+			free_chunk_map(&map);
+
+			block_load = 0;
+			for (u32 i = 0; i < num_chunks; i++) {
+				u64 start = get_time_ns();
+				hull_chunk(chunks, i);
+				u64 mid = get_time_ns();
+				update_chunk(chunks, i);
+				u64 end = get_time_ns();
+
+				push_sample(&hull_samples, mid - start);
+				push_sample(&update_samples, end - mid);
+				block_load += chunks[i]->num_blocks;
+			}
+
+			u64 world_ns = get_time_ns() - world_start;
+			push_sample(&world_samples, world_ns);
+			total_ns += world_ns;
+
+			if (r + 1 < runs) {
+				for (u32 i = 0; i < num_chunks; i++) {
+					free_chunk(chunks[i]);
+				}
+			}
+		}
+
+		world_bytes = world_memory_usage(chunks);
+
+		// The last serial world is kept as the reference for the parallel build
+		Chunk **parallel_chunks = (Chunk **)malloc(sizeof(Chunk *) * num_chunks);
+		bool matches_serial = true;
+		u64 parallel_total_ns = 0;
+
+		for (u32 r = 0; r < runs; r++) {
+			u64 start = get_time_ns();
+			build_world(jobs, parallel_chunks);
+			u64 world_ns = get_time_ns() - start;
+			push_sample(&parallel_samples, world_ns);
+			parallel_total_ns += world_ns;
+
+			for (u32 i = 0; i < num_chunks; i++) {
+				matches_serial = matches_serial && chunks_match(chunks[i], parallel_chunks[i]);
+				free_chunk(parallel_chunks[i]);
+			}
+		}
+
+		for (u32 i = 0; i < num_chunks; i++) {
+			free_chunk(chunks[i]);
+		}
+		free(parallel_chunks);
+		free(chunks);
+
+		printf("    {\n");
+		printf("      \"num_x_chunks\": %u,\n      \"num_y_chunks\": %u,\n      \"num_chunks\": %u,\n", num_x_chunks, num_y_chunks, num_chunks);
+		printf("      \"blocks\": %lu,\n", block_load);
+		printf("      \"chunk_bytes\": %lu,\n", world_bytes / num_chunks);
+		printf("      \"world_bytes\": %lu,\n", world_bytes);
+		printf("      \"blocks_per_sec\": %.1f,\n", (f64)(block_load * runs) / ((f64)total_ns / 1000000000.0));
+		printf("      \"stages\": {\n");
+		print_stats("generate_chunk", &gen_samples, false);
+		print_stats("hull_chunk", &hull_samples, false);
+		print_stats("update_chunk", &update_samples, false);
+		print_stats("world", &world_samples, true);
+		printf("      },\n");
+		printf("      \"parallel\": {\n");
+		printf("        \"blocks_per_sec\": %.1f,\n", (f64)(block_load * runs) / ((f64)parallel_total_ns / 1000000000.0));
+		printf("        \"speedup\": %.2f,\n", (f64)total_ns / (f64)parallel_total_ns);
+		printf("        \"matches_serial\": %s,\n", matches_serial ? "true" : "false");
+		print_stats("world", &parallel_samples, true);
+		printf("      },\n");
+		printf("      \"peak_rss_kb\": %lu\n", get_peak_rss_kb());
+		printf("    }%s\n", s + 1 < num_sizes ? "," : "");
+	}
+	printf("  ]\n}\n");
+
+	destroy_job_system(jobs);
+
+	return 0;
+}
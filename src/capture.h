@@ -0,0 +1,240 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+#include "timer.h"
+#include "trace.h"
+#include "gl_helper.h"
+#include "tga.h"
+
+// Records every frame drawn as a numbered TGA file without waiting on the
+// GPU or the disk. Each frame is read back into one of CAPTURE_PBOS pixel
+// buffers and fenced; the buffer is only mapped CAPTURE_PBOS frames later,
+// when the copy has long finished. Its pixels are handed to a writer thread
+// that encodes and writes them. When the writer falls behind and every
+// spare pixel buffer is queued, frames are dropped rather than waited for.
+
+#define CAPTURE_PBOS 3
+// Frames copied out of the PBOs and waiting for the writer
+#define CAPTURE_QUEUE 8
+
+typedef struct CaptureStats {
+	u32 frames_read;
+	u32 frames_written;
+	u32 frames_dropped;
+	u32 write_failures;
+	// Readbacks still running CAPTURE_PBOS frames later, which the render
+	// thread then waited for
+	u32 stalls;
+	// Spent in capture_frame, on the render thread
+	u64 render_ns;
+	u64 render_max_ns;
+	// Spent encoding and writing, on the writer thread
+	u64 write_ns;
+} CaptureStats;
+
+typedef struct CaptureFrame {
+	u8 *pixels;
+	u32 frame;
+} CaptureFrame;
+
+typedef struct FrameCapture {
+	const char *dir;
+	i32 width;
+	i32 height;
+	u64 frame_bytes;
+
+	GLuint pbos[CAPTURE_PBOS];
+	GLsync fences[CAPTURE_PBOS];
+	u32 pbo_frames[CAPTURE_PBOS];
+	u32 frame;
+
+	// Pixel buffers not in use, and frames waiting to be written in order
+	std::mutex lock;
+	std::condition_variable wake;
+	u8 *free_pixels[CAPTURE_QUEUE];
+	u32 num_free;
+	CaptureFrame queue[CAPTURE_QUEUE];
+	u32 queue_head;
+	u32 queue_count;
+	bool running;
+	std::thread writer;
+
+	// The writer's counters are only read once it has stopped, or as a
+	// snapshot under the lock
+	CaptureStats stats;
+} FrameCapture;
+
+void capture_writer_loop(FrameCapture *capture) {
+	trace_name_thread("capture writer");
+
+	for (;;) {
+		CaptureFrame item;
+		{
+			std::unique_lock<std::mutex> lock(capture->lock);
+			capture->wake.wait(lock, [capture] { return capture->queue_count > 0 || !capture->running; });
+			if (capture->queue_count == 0) {
+				return;
+			}
+			item = capture->queue[capture->queue_head];
+			capture->queue_head = (capture->queue_head + 1) % CAPTURE_QUEUE;
+			capture->queue_count--;
+		}
+
+		TRACE_SCOPE("write_capture");
+		u64 start = get_time_ns();
+		char filename[1024];
+		snprintf(filename, sizeof(filename), "%s/frame_%06u.tga", capture->dir, item.frame);
+		Image img;
+		img.width = capture->width;
+		img.height = capture->height;
+		img.bytes_per_pixel = 3;
+		img.data = item.pixels;
+		bool written = write_tga(filename, &img, false);
+
+		std::lock_guard<std::mutex> guard(capture->lock);
+		capture->stats.write_ns += get_time_ns() - start;
+		capture->stats.frames_written += written;
+		capture->stats.write_failures += !written;
+		capture->free_pixels[capture->num_free++] = item.pixels;
+	}
+}
+
+// Frames are written to dir, which must exist
+FrameCapture *create_frame_capture(const char *dir, i32 width, i32 height) {
+	FrameCapture *capture = new FrameCapture();
+	capture->dir = dir;
+	capture->width = width;
+	capture->height = height;
+	capture->frame_bytes = (u64)width * height * 3;
+
+	glGenBuffers(CAPTURE_PBOS, capture->pbos);
+	for (u32 i = 0; i < CAPTURE_PBOS; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, capture->frame_bytes, NULL, GL_STREAM_READ);
+		capture->fences[i] = NULL;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	for (u32 i = 0; i < CAPTURE_QUEUE; i++) {
+		capture->free_pixels[i] = (u8 *)malloc(capture->frame_bytes);
+	}
+	capture->num_free = CAPTURE_QUEUE;
+	capture->running = true;
+	capture->writer = std::thread(capture_writer_loop, capture);
+	return capture;
+}
+
+// Maps the PBO read back CAPTURE_PBOS frames ago and queues its pixels,
+// waiting for the readback only if it has somehow not finished
+void collect_capture_pbo(FrameCapture *capture, u32 slot) {
+	GLsync fence = capture->fences[slot];
+	if (!fence) {
+		return;
+	}
+
+	GLenum status = glClientWaitSync(fence, 0, 0);
+	if (status == GL_TIMEOUT_EXPIRED) {
+		capture->stats.stalls++;
+		do {
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		} while (status == GL_TIMEOUT_EXPIRED);
+	}
+	GL_CHECK(glDeleteSync(fence));
+	capture->fences[slot] = NULL;
+
+	u8 *pixels = NULL;
+	{
+		std::lock_guard<std::mutex> guard(capture->lock);
+		if (capture->num_free > 0) {
+			pixels = capture->free_pixels[--capture->num_free];
+		}
+	}
+	if (!pixels) {
+		capture->stats.frames_dropped++;
+		return;
+	}
+
+	GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbos[slot]));
+	void *mapped = NULL;
+	GL_CHECK(mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, capture->frame_bytes, GL_MAP_READ_BIT));
+	if (mapped) {
+		memcpy(pixels, mapped, capture->frame_bytes);
+	}
+	GL_CHECK(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+	capture->stats.frames_read++;
+
+	std::lock_guard<std::mutex> guard(capture->lock);
+	if (!mapped) {
+		capture->free_pixels[capture->num_free++] = pixels;
+		capture->stats.frames_dropped++;
+		return;
+	}
+	u32 tail = (capture->queue_head + capture->queue_count) % CAPTURE_QUEUE;
+	capture->queue[tail].pixels = pixels;
+	capture->queue[tail].frame = capture->pbo_frames[slot];
+	capture->queue_count++;
+	capture->wake.notify_one();
+}
+
+// Call after the frame's last draw. Starts reading the bound read
+// framebuffer back and queues the frame read CAPTURE_PBOS frames ago.
+void capture_frame(FrameCapture *capture) {
+	TRACE_SCOPE("capture_frame");
+	u64 start = get_time_ns();
+	u32 slot = capture->frame % CAPTURE_PBOS;
+	collect_capture_pbo(capture, slot);
+
+	// Rows come bottom up, as TGA stores them
+	GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbos[slot]));
+	GL_CHECK(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+	GL_CHECK(glReadPixels(0, 0, capture->width, capture->height, GL_BGR, GL_UNSIGNED_BYTE, 0));
+	GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+	GL_CHECK(capture->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+	capture->pbo_frames[slot] = capture->frame;
+	capture->frame++;
+
+	u64 elapsed = get_time_ns() - start;
+	capture->stats.render_ns += elapsed;
+	capture->stats.render_max_ns = elapsed > capture->stats.render_max_ns ? elapsed : capture->stats.render_max_ns;
+}
+
+// A snapshot of the counters, safe while the writer runs
+CaptureStats get_capture_stats(FrameCapture *capture) {
+	std::lock_guard<std::mutex> guard(capture->lock);
+	return capture->stats;
+}
+
+// Queues the frames still in the PBOs, waits for the writer to finish them
+// all and frees everything
+void free_frame_capture(FrameCapture *capture, CaptureStats *stats) {
+	for (u32 i = 0; i < CAPTURE_PBOS; i++) {
+		collect_capture_pbo(capture, (capture->frame + i) % CAPTURE_PBOS);
+	}
+	GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+	{
+		std::lock_guard<std::mutex> guard(capture->lock);
+		capture->running = false;
+	}
+	capture->wake.notify_one();
+	capture->writer.join();
+
+	if (stats) {
+		*stats = capture->stats;
+	}
+	glDeleteBuffers(CAPTURE_PBOS, capture->pbos);
+	for (u32 i = 0; i < capture->num_free; i++) {
+		free(capture->free_pixels[i]);
+	}
+	delete capture;
+}
+
+#endif
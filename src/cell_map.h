@@ -0,0 +1,132 @@
+#ifndef CELL_MAP_H
+#define CELL_MAP_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+// Open-addressing (linear probing) map from a chunk cell index to the
+// instance drawn for it. Sized to the visible set rather than to every cell.
+
+#define CELL_MAP_EMPTY 0xFFFFFFFFu
+
+typedef struct CellMap {
+	u32 *keys;
+	u32 *values;
+	u32 capacity;
+	u32 count;
+} CellMap;
+
+u32 cell_map_slot(CellMap *map, u32 key) {
+	return (key * 2654435761u) & (map->capacity - 1);
+}
+
+// Empties the map, growing it so expected entries stay under half load
+void cell_map_reset(CellMap *map, u32 expected) {
+	u32 capacity = map->capacity ? map->capacity : 16;
+	while (capacity < expected * 2) {
+		capacity *= 2;
+	}
+
+	if (capacity != map->capacity) {
+		free(map->keys);
+		free(map->values);
+		map->keys = (u32 *)malloc(sizeof(u32) * capacity);
+		map->values = (u32 *)malloc(sizeof(u32) * capacity);
+		map->capacity = capacity;
+	}
+
+	memset(map->keys, 0xFF, sizeof(u32) * map->capacity);
+	map->count = 0;
+}
+
+void cell_map_insert(CellMap *map, u32 key, u32 value) {
+	if ((map->count + 1) * 2 > map->capacity) {
+		CellMap grown = {};
+		cell_map_reset(&grown, map->count + 1);
+		for (u32 i = 0; i < map->capacity; i++) {
+			if (map->keys[i] != CELL_MAP_EMPTY) {
+				cell_map_insert(&grown, map->keys[i], map->values[i]);
+			}
+		}
+		free(map->keys);
+		free(map->values);
+		*map = grown;
+	}
+
+	u32 slot = cell_map_slot(map, key);
+	while (map->keys[slot] != CELL_MAP_EMPTY && map->keys[slot] != key) {
+		slot = (slot + 1) & (map->capacity - 1);
+	}
+
+	if (map->keys[slot] == CELL_MAP_EMPTY) {
+		map->count++;
+	}
+	map->keys[slot] = key;
+	map->values[slot] = value;
+}
+
+bool cell_map_find(CellMap *map, u32 key, u32 *value) {
+	if (map->capacity == 0) {
+		return false;
+	}
+
+	u32 slot = cell_map_slot(map, key);
+	while (map->keys[slot] != CELL_MAP_EMPTY) {
+		if (map->keys[slot] == key) {
+			*value = map->values[slot];
+			return true;
+		}
+		slot = (slot + 1) & (map->capacity - 1);
+	}
+	return false;
+}
+
+// Backward-shift deletion, so lookups never need tombstones
+void cell_map_remove(CellMap *map, u32 key) {
+	if (map->capacity == 0) {
+		return;
+	}
+
+	u32 mask = map->capacity - 1;
+	u32 slot = cell_map_slot(map, key);
+	while (map->keys[slot] != key) {
+		if (map->keys[slot] == CELL_MAP_EMPTY) {
+			return;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	u32 hole = slot;
+	u32 next = (hole + 1) & mask;
+	while (map->keys[next] != CELL_MAP_EMPTY) {
+		u32 home = cell_map_slot(map, map->keys[next]);
+		// The entry may move into the hole unless its home lies cyclically
+		// between the hole and its current slot
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			map->keys[hole] = map->keys[next];
+			map->values[hole] = map->values[next];
+			hole = next;
+		}
+		next = (next + 1) & mask;
+	}
+
+	map->keys[hole] = CELL_MAP_EMPTY;
+	map->count--;
+}
+
+u64 cell_map_memory_usage(CellMap *map) {
+	return (u64)map->capacity * sizeof(u32) * 2;
+}
+
+void free_cell_map(CellMap *map) {
+	free(map->keys);
+	free(map->values);
+	map->keys = NULL;
+	map->values = NULL;
+	map->capacity = 0;
+	map->count = 0;
+}
+
+#endif
@@ -0,0 +1,675 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "point.h"
+#include "perlin_simd.h"
+#include "cell_map.h"
+#include "trace.h"
+
+u32 chunk_width = 16;
+u32 chunk_height = 256;
+u32 chunk_depth = 16;
+u32 chunk_size = chunk_width * chunk_height * chunk_depth;
+
+// Words in a column of occupancy bits, chunk_height / 64
+#define COLUMN_WORDS 4
+
+u32 num_x_chunks = 9;
+u32 num_y_chunks = 9;
+u32 num_chunks = num_x_chunks * num_y_chunks;
+
+// Faces in the order of cube.h: front, top, back, bottom, left, right
+typedef enum Face {
+	FACE_FRONT,
+	FACE_TOP,
+	FACE_BACK,
+	FACE_BOTTOM,
+	FACE_LEFT,
+	FACE_RIGHT,
+	NUM_FACES,
+} Face;
+
+// Outward normal of each face
+i32 face_normals[NUM_FACES][3] = {
+	{0, 0, 1},
+	{0, 1, 0},
+	{0, 0, -1},
+	{0, -1, 0},
+	{-1, 0, 0},
+	{1, 0, 0},
+};
+
+// Face on the other side of each face
+u32 opposite_faces[NUM_FACES] = {
+	FACE_BACK,
+	FACE_BOTTOM,
+	FACE_FRONT,
+	FACE_TOP,
+	FACE_RIGHT,
+	FACE_LEFT,
+};
+
+// Unit corners of each face, same winding as cube_points
+f32 face_corners[NUM_FACES][4][3] = {
+	{{0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}},
+	{{0, 1, 1}, {1, 1, 1}, {1, 1, 0}, {0, 1, 0}},
+	{{1, 0, 0}, {0, 0, 0}, {0, 1, 0}, {1, 1, 0}},
+	{{0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1}},
+	{{0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}},
+	{{1, 0, 1}, {1, 0, 0}, {1, 1, 0}, {1, 1, 1}},
+};
+
+typedef struct Chunk {
+	// Tile id of every cell with an exposed face, 0 elsewhere
+	u8 *pre_render_list;
+	// Solid cells, COLUMN_WORDS words per column in real_blocks order, cell
+	// y in bit y % 64 of word y / 64
+	u64 *occupancy;
+	// Cells hull_chunk marked, laid out like occupancy; the only non-zero
+	// cells of pre_render_list and face_masks
+	u64 *hull_bits;
+	// Highest solid cell of each column. The bottom layer cannot be removed,
+	// so every column has one.
+	u8 *real_blocks;
+	// Bit f is set when face f of the cell is exposed to air
+	u8 *face_masks;
+
+	// One packed instance (see pack_instance) per exposed face, grouped by
+	// face so that group f is [face_offsets[f], face_offsets[f + 1]).
+	// Render data is sized to the visible set: instances holds
+	// instance_capacity entries, and mappings only has entries for faces
+	// that are drawn, keyed by face_key(cell, face)
+	CellMap mappings;
+	u32 *instances;
+	u32 face_offsets[NUM_FACES + 1];
+
+	u64 num_blocks;
+	u64 num_instances;
+	u64 instance_capacity;
+	// Set by update_chunk, cleared once the GPU copy of the instances or
+	// of the greedy mesh is refreshed
+	bool dirty;
+	bool mesh_dirty;
+	// World position of the chunk's first column
+	i32 x_off;
+	i32 z_off;
+	// Lowest and highest drawn cell, for the chunk's bounding box
+	u32 min_y;
+	u32 max_y;
+	// No column is taller, kept from the heightmap as soon as it is filled
+	// in; edits only ever raise it
+	u8 top;
+
+	// Loaded chunk beside each side face, kept up to date by the chunk map
+	// (see chunk_map.h); NULL past the edge of the loaded world
+	struct Chunk *neighbours[NUM_FACES];
+	// Place in the chunk map's eviction order while the chunk is unused
+	struct Chunk *lru_prev;
+	struct Chunk *lru_next;
+	bool in_lru;
+	// Set once hull_chunk has run, after which edits keep the render data
+	// up to date
+	bool hulled;
+	// Blocks match the chunk's record in the region store, see region.h
+	bool saved;
+} Chunk;
+
+// Empty chunk at chunk coordinates (cx, cz) with its block arrays allocated
+// but not filled in
+Chunk *new_chunk(i32 cx, i32 cz) {
+	Chunk *chunk = (Chunk *)malloc(sizeof(Chunk));
+
+	memset(chunk, 0, sizeof(Chunk));
+	chunk->pre_render_list = (u8 *)calloc(chunk_size, 1);
+	chunk->face_masks = (u8 *)calloc(chunk_size, 1);
+	chunk->occupancy = (u64 *)calloc(chunk_width * chunk_depth * COLUMN_WORDS, sizeof(u64));
+	chunk->hull_bits = (u64 *)calloc(chunk_width * chunk_depth * COLUMN_WORDS, sizeof(u64));
+	chunk->real_blocks = (u8 *)malloc(chunk_width * chunk_depth);
+	chunk->x_off = cx * (i32)chunk_width;
+	chunk->z_off = cz * (i32)chunk_depth;
+	return chunk;
+}
+
+u64 *chunk_column(Chunk *chunk, u32 x, u32 z) {
+	return chunk->occupancy + twod_to_oned(x, z, chunk_width) * COLUMN_WORDS;
+}
+
+bool column_solid(const u64 *column, u32 y) {
+	return (column[y / 64] >> (y % 64)) & 1;
+}
+
+// Sets the bits of cells from_y up to, not including, to_y
+void fill_column(u64 *column, u32 from_y, u32 to_y) {
+	for (u32 w = from_y / 64; w < COLUMN_WORDS && w * 64 < to_y; w++) {
+		u32 lo = from_y > w * 64 ? from_y - w * 64 : 0;
+		u32 hi = to_y < (w + 1) * 64 ? to_y - w * 64 : 64;
+		u64 bits = hi == 64 ? ~0ul : (1ul << hi) - 1;
+		column[w] |= bits & ~((1ul << lo) - 1);
+	}
+}
+
+// -1 for a column with no solid cell
+i32 highest_solid(const u64 *column) {
+	for (i32 w = COLUMN_WORDS - 1; w >= 0; w--) {
+		if (column[w]) {
+			return w * 64 + 63 - __builtin_clzl(column[w]);
+		}
+	}
+	return -1;
+}
+
+void update_chunk_top(Chunk *chunk) {
+	chunk->top = 0;
+	for (u32 i = 0; i < chunk_width * chunk_depth; i++) {
+		chunk->top = chunk->real_blocks[i] > chunk->top ? chunk->real_blocks[i] : chunk->top;
+	}
+}
+
+// x_off and z_off are chunk coordinates, which may be negative
+Chunk *generate_chunk(i32 x_off, i32 z_off) {
+	TRACE_SCOPE("generate_chunk");
+	Chunk *chunk = new_chunk(x_off, z_off);
+	u8 *height_map = chunk->real_blocks;
+
+	f32 min_height = chunk_height / 5;
+	f32 avg_height = chunk_height / 2;
+
+	// Octaves are sampled for the whole chunk at once so the noise kernel
+	// can run several columns per step; columns are in height_map order
+	u32 num_columns = chunk_width * chunk_depth;
+	f32 *column_heights = (f32 *)malloc(sizeof(f32) * num_columns * 5);
+	f32 *noise_x = column_heights + num_columns;
+	f32 *noise_y = noise_x + num_columns;
+	f32 *noise_z = noise_y + num_columns;
+	f32 *noise = noise_z + num_columns;
+
+	for (u32 i = 0; i < num_columns; i++) {
+		column_heights[i] = avg_height;
+	}
+
+	for (u8 o = 5; o < 8; o++) {
+		f32 scale = (f32)(2 << o) * 1.01f;
+		for (u32 i = 0; i < num_columns; i++) {
+			Point p = oned_to_twod(i, chunk_width);
+			noise_x[i] = (f32)((i32)p.x + chunk->x_off) / scale;
+			noise_y[i] = (f32)((i32)p.y + chunk->z_off) / scale;
+			noise_z[i] = o * 2.0f;
+		}
+
+		perlin_noise3_batch(noise_x, noise_y, noise_z, num_columns, 256, 256, 256, noise);
+
+		for (u32 i = 0; i < num_columns; i++) {
+			column_heights[i] += (f32)(o << 4) * noise[i];
+		}
+	}
+
+	for (u32 i = 0; i < num_columns; i++) {
+		f32 column_height = column_heights[i];
+
+		if (column_height > chunk_height) {
+			column_height = chunk_height;
+		}
+
+		if (column_height < min_height) {
+			column_height = min_height;
+		}
+
+		height_map[i] = column_height;
+		fill_column(chunk->occupancy + i * COLUMN_WORDS, 0, height_map[i] + 1);
+	}
+
+	free(column_heights);
+	update_chunk_top(chunk);
+
+	return chunk;
+}
+
+
+bool inside_chunk(u32 x, u32 y, u32 z) {
+	if (x < chunk_width && y < chunk_height && z < chunk_depth) {
+		return true;
+	}
+
+	return false;
+}
+
+// chunks is a grid of num_x_chunks x num_y_chunks slots, which per-chunk
+// render data is indexed by. The chunk at chunk coordinates (cx, cz) is drawn
+// from slot (cx, cz) wrapped to the grid, so a fixed world starting at (0, 0)
+// is stored in order, while a world streamed around the camera reuses the
+// slots of chunks it leaves behind. Lookups by coordinates go through the
+// chunk map instead, see chunk_map.h.
+u32 chunk_slot(i32 cx, i32 cz) {
+	i32 sx = cx % (i32)num_x_chunks;
+	i32 sz = cz % (i32)num_y_chunks;
+	sx += sx < 0 ? num_x_chunks : 0;
+	sz += sz < 0 ? num_y_chunks : 0;
+	return twod_to_oned(sx, sz, num_x_chunks);
+}
+
+// The chunk drawn from (cx, cz)'s slot, NULL when the slot is empty or holds
+// another chunk
+Chunk *find_chunk(Chunk **chunks, i32 cx, i32 cz) {
+	Chunk *chunk = chunks[chunk_slot(cx, cz)];
+	if (!chunk || chunk->x_off != cx * (i32)chunk_width || chunk->z_off != cz * (i32)chunk_depth) {
+		return NULL;
+	}
+	return chunk;
+}
+
+// Chunk holding the column at chunk-local (x, z), which may lie one step
+// into a neighbouring chunk; x and z are made local to the chunk returned.
+// NULL outside the loaded world.
+Chunk *column_chunk(Chunk *chunk, i32 *x, i32 *z) {
+	if (*x < 0) {
+		chunk = chunk->neighbours[FACE_LEFT];
+		*x += chunk_width;
+	} else if (*x >= (i32)chunk_width) {
+		chunk = chunk->neighbours[FACE_RIGHT];
+		*x -= chunk_width;
+	}
+
+	if (chunk && *z < 0) {
+		chunk = chunk->neighbours[FACE_BACK];
+		*z += chunk_depth;
+	} else if (chunk && *z >= (i32)chunk_depth) {
+		chunk = chunk->neighbours[FACE_FRONT];
+		*z -= chunk_depth;
+	}
+	return chunk;
+}
+
+// Height of the column at chunk-local (x, z), which may lie one step into a
+// neighbouring chunk. Columns outside the loaded world are -1, i.e. all air.
+i32 chunk_column_height(Chunk *chunk, i32 x, i32 z) {
+	chunk = column_chunk(chunk, &x, &z);
+	if (!chunk) {
+		return -1;
+	}
+
+	return chunk->real_blocks[twod_to_oned(x, z, chunk_width)];
+}
+
+i32 column_height(Chunk **chunks, u32 chunk_idx, i32 x, i32 z) {
+	return chunk_column_height(chunks[chunk_idx], x, z);
+}
+
+u64 full_column[COLUMN_WORDS] = {~0ul, ~0ul, ~0ul, ~0ul};
+u64 empty_column[COLUMN_WORDS];
+
+// Occupancy of the column at chunk-local (x, z), found as for
+// chunk_column_height. Columns outside the loaded world are all solid, so
+// hulling does not wall in its edge.
+const u64 *neighbour_column(Chunk *chunk, i32 x, i32 z) {
+	chunk = column_chunk(chunk, &x, &z);
+	return chunk ? chunk_column(chunk, x, z) : full_column;
+}
+
+// Cells below the world or outside the loaded world count as solid, cells
+// above it as air, the way hull_column sees them
+bool chunk_block_solid(Chunk *chunk, i32 x, i32 y, i32 z) {
+	if (y < 0) {
+		return true;
+	}
+	if (y >= (i32)chunk_height) {
+		return false;
+	}
+	return column_solid(neighbour_column(chunk, x, z), y);
+}
+
+u32 face_key(u32 cell, u32 face) {
+	return (cell << 3) | face;
+}
+
+// Tile id a marked cell takes from its exposed faces: the top's if it is
+// exposed, else the first exposed face's
+u8 face_tiles[NUM_FACES] = {5, 1, 4, 9, 2, 3};
+
+// Marks the cells of column (x, z) with an exposed face in pre_render_list,
+// face_masks and hull_bits, clearing whatever the column had marked before.
+// A face is exposed when the cell on its other side is air, so each face is
+// found for 64 cells at once by masking the column's bits with the
+// neighbouring column's, or with its own shifted by one cell for the top
+// and bottom. The bottom of the lowest cell is never exposed.
+void hull_column(Chunk *chunk, u32 x, u32 z) {
+	u64 *hull = chunk->hull_bits + twod_to_oned(x, z, chunk_width) * COLUMN_WORDS;
+	for (u32 w = 0; w < COLUMN_WORDS; w++) {
+		for (u64 bits = hull[w]; bits; bits &= bits - 1) {
+			u32 cell = threed_to_oned(x, w * 64 + __builtin_ctzl(bits), z, chunk_width, chunk_height);
+			chunk->pre_render_list[cell] = 0;
+			chunk->face_masks[cell] = 0;
+		}
+	}
+
+	// Neighbours inside the chunk are a fixed stride away
+	const u64 *solid = chunk_column(chunk, x, z);
+	u32 row = chunk_width * COLUMN_WORDS;
+	const u64 *front = z + 1 < chunk_depth ? solid + row : neighbour_column(chunk, x, z + 1);
+	const u64 *back = z > 0 ? solid - row : neighbour_column(chunk, x, (i32)z - 1);
+	const u64 *left = x > 0 ? solid - COLUMN_WORDS : neighbour_column(chunk, (i32)x - 1, z);
+	const u64 *right = x + 1 < chunk_width ? solid + COLUMN_WORDS : neighbour_column(chunk, x + 1, z);
+
+	for (u32 w = 0; w < COLUMN_WORDS; w++) {
+		u64 cells = solid[w];
+		if (!cells) {
+			hull[w] = 0;
+			continue;
+		}
+		u64 above = (cells >> 1) | (w + 1 < COLUMN_WORDS ? solid[w + 1] << 63 : 0);
+		u64 below = (cells << 1) | (w > 0 ? solid[w - 1] >> 63 : 1);
+
+		u64 marked = cells & ~(front[w] & back[w] & left[w] & right[w] & above & below);
+		hull[w] = marked;
+		if (!marked) {
+			continue;
+		}
+
+		u64 exposed[NUM_FACES];
+		exposed[FACE_FRONT] = cells & ~front[w];
+		exposed[FACE_TOP] = cells & ~above;
+		exposed[FACE_BACK] = cells & ~back[w];
+		exposed[FACE_BOTTOM] = cells & ~below;
+		exposed[FACE_LEFT] = cells & ~left[w];
+		exposed[FACE_RIGHT] = cells & ~right[w];
+
+		for (u64 bits = marked; bits; bits &= bits - 1) {
+			u32 b = __builtin_ctzl(bits);
+			u8 mask = 0;
+			for (u32 f = 0; f < NUM_FACES; f++) {
+				mask |= ((exposed[f] >> b) & 1) << f;
+			}
+
+			u32 cell = threed_to_oned(x, w * 64 + b, z, chunk_width, chunk_height);
+			chunk->face_masks[cell] = mask;
+			chunk->pre_render_list[cell] = face_tiles[mask & (1 << FACE_TOP) ? FACE_TOP : __builtin_ctz(mask)];
+		}
+	}
+}
+
+// Marks every cell of the chunk with an exposed face, see hull_column.
+// Cells on the chunk's edges are tested against the neighbouring chunks.
+void hull_chunk(Chunk **chunks, u32 chunk_idx) {
+	TRACE_SCOPE("hull_chunk");
+	Chunk *chunk = chunks[chunk_idx];
+	for (u32 z = 0; z < chunk_depth; z++) {
+		for (u32 x = 0; x < chunk_width; x++) {
+			hull_column(chunk, x, z);
+		}
+	}
+	chunk->hulled = true;
+}
+
+// Debug colours, one per face that can mark a cell (see face_tiles).
+// Uploaded to the block shader as its palette, indexed by tile id.
+#define NUM_TILES 16
+
+glm::vec3 tile_palette[NUM_TILES] = {
+	glm::vec3(0.0, 0.0, 0.0),
+	//green
+	glm::vec3(0.0, 0.3, 0.0),
+	//blue
+	glm::vec3(0.0, 0.0, 1.0),
+	//GB
+	glm::vec3(1.0, 0.645, 0.0),
+	//RB
+	glm::vec3(1.0, 0.0, 1.0),
+	//red
+	glm::vec3(1.0, 0.0, 0.0),
+	//red
+	glm::vec3(0.5, 1.0, 0.8),
+	//gray
+	glm::vec3(0.255, 0.412, 0.88),
+	//white
+	glm::vec3(1.0, 1.0, 1.0),
+	//magenta
+	glm::vec3(0.9, 0.2, 0.5),
+};
+
+#define TILE_WHITE 8
+
+// Instances are one u32 in chunk-local coordinates, decoded by
+// obj_vert.vsh: x in bits 0-3, y in 4-11, z in 12-15, tile id in 16-23 and
+// the face's ambient occlusion (see face_ao) in 24-31.
+u32 pack_instance(u32 x, u32 y, u32 z, u8 tile_id, u8 ao) {
+	return (x & 0xF) | ((y & 0xFF) << 4) | ((z & 0xF) << 12) | ((u32)tile_id << 16) | ((u32)ao << 24);
+}
+
+Point unpack_instance(u32 instance) {
+	return new_point(instance & 0xF, (instance >> 4) & 0xFF, (instance >> 12) & 0xF);
+}
+
+// Ambient occlusion is two bits per face corner, corners in face_corners
+// order: 3 when none of the three cells touching the corner in front of the
+// face is solid, one less for each that is, and 0 when both edge cells are.
+// Turned off, every corner is fully lit.
+bool ambient_occlusion = true;
+
+#define AO_LIT 0xFF
+
+// Brightness of each ambient occlusion level, for the shaders
+f32 ao_levels[4] = {0.45f, 0.6f, 0.8f, 1.0f};
+
+// Bit b of around[(dx + 1) * 9 + (dy + 1) * 3 + dz + 1] is the cell at
+// (dx, dy, dz) from the cell in bit b of word w of column (x, z), so a
+// neighbour of all 64 cells is one load. Columns outside the loaded world
+// are air here, unlike for hulling, so the edge of the world is not darkened.
+void gather_neighbourhood(Chunk *chunk, u32 x, u32 z, u32 w, u64 *around) {
+	bool interior = x > 0 && z > 0 && x + 1 < chunk_width && z + 1 < chunk_depth;
+	for (i32 dz = -1; dz <= 1; dz++) {
+		for (i32 dx = -1; dx <= 1; dx++) {
+			const u64 *column;
+			if (interior) {
+				column = chunk_column(chunk, x + dx, z + dz);
+			} else {
+				i32 nx = (i32)x + dx;
+				i32 nz = (i32)z + dz;
+				Chunk *owner = column_chunk(chunk, &nx, &nz);
+				column = owner ? chunk_column(owner, nx, nz) : empty_column;
+			}
+
+			u64 cells = column[w];
+			u64 *planes = around + (dx + 1) * 9 + dz + 1;
+			planes[0] = (cells << 1) | (w > 0 ? column[w - 1] >> 63 : 1);
+			planes[3] = cells;
+			planes[6] = (cells >> 1) | (w + 1 < COLUMN_WORDS ? column[w + 1] << 63 : 0);
+		}
+	}
+}
+
+// Ambient occlusion of one face of 64 cells, bit-sliced: corner k of the
+// face of the cell in bit b is (hi[k] >> b & 1) << 1 | (lo[k] >> b & 1).
+// Bits of shaded are the cells with a corner that is not fully lit.
+typedef struct FaceAO {
+	u64 lo[4];
+	u64 hi[4];
+	u64 shaded;
+} FaceAO;
+
+// Cells in front of each corner of each face, as indices into
+// gather_neighbourhood's around: the two beside the face's edges at the
+// corner, then the one across it
+u8 ao_neighbours[NUM_FACES][4][3] = {
+	{{5, 11, 2}, {23, 11, 20}, {23, 17, 26}, {5, 17, 8}},
+	{{7, 17, 8}, {25, 17, 26}, {25, 15, 24}, {7, 15, 6}},
+	{{21, 9, 18}, {3, 9, 0}, {3, 15, 6}, {21, 15, 24}},
+	{{1, 9, 0}, {19, 9, 18}, {19, 11, 20}, {1, 11, 2}},
+	{{1, 3, 0}, {1, 5, 2}, {7, 5, 8}, {7, 3, 6}},
+	{{19, 23, 20}, {19, 21, 18}, {25, 21, 24}, {25, 23, 26}},
+};
+
+void face_ao(u64 *around, u32 face, FaceAO *ao) {
+	u64 shaded = 0;
+	for (u32 k = 0; k < 4; k++) {
+		u8 *cells = ao_neighbours[face][k];
+		u64 s1 = around[cells[0]];
+		u64 s2 = around[cells[1]];
+		u64 c = around[cells[2]];
+		u64 both = s1 & s2;
+		u64 either = s1 | s2;
+		// 3 minus the number of solid cells, as two bit planes
+		ao->lo[k] = ~(either ^ c) & ~both;
+		ao->hi[k] = ~(either & c) & ~both;
+		shaded |= either | c;
+	}
+	ao->shaded = shaded;
+}
+
+u8 cell_ao(FaceAO *ao, u32 b) {
+	if (!((ao->shaded >> b) & 1)) {
+		return AO_LIT;
+	}
+
+	u8 bits = 0;
+	for (u32 k = 0; k < 4; k++) {
+		bits |= (((ao->hi[k] >> b) & 1) << 1 | ((ao->lo[k] >> b) & 1)) << (2 * k);
+	}
+	return bits;
+}
+
+// Ambient occlusion of the faces in face_mask for the 64 cells of word w of
+// column (x, z), indexed by face. Every corner is lit when
+// ambient_occlusion is off.
+void column_word_ao(Chunk *chunk, u32 x, u32 z, u32 w, u8 face_mask, FaceAO *ao) {
+	if (!ambient_occlusion) {
+		for (u32 f = 0; f < NUM_FACES; f++) {
+			memset(ao[f].lo, 0xFF, sizeof(ao[f].lo));
+			memset(ao[f].hi, 0xFF, sizeof(ao[f].hi));
+			ao[f].shaded = 0;
+		}
+		return;
+	}
+
+	u64 around[27];
+	gather_neighbourhood(chunk, x, z, w, around);
+	for (u32 f = 0; f < NUM_FACES; f++) {
+		if ((face_mask >> f) & 1) {
+			face_ao(around, f, &ao[f]);
+		}
+	}
+}
+
+void update_chunk(Chunk **chunks, u32 chunk_idx) {
+	TRACE_SCOPE("update_chunk");
+	Chunk *chunk = chunks[chunk_idx];
+
+	u32 face_counts[NUM_FACES] = {};
+	u64 visible = 0;
+	u32 min_y = chunk_height;
+	u32 max_y = 0;
+	// Only the cells hull_chunk marked are visited, column by column
+	for (u32 c = 0; c < chunk_width * chunk_depth; c++) {
+		Point column = oned_to_twod(c, chunk_width);
+		for (u32 w = 0; w < COLUMN_WORDS; w++) {
+			for (u64 bits = chunk->hull_bits[c * COLUMN_WORDS + w]; bits; bits &= bits - 1) {
+				u32 y = w * 64 + __builtin_ctzl(bits);
+				u8 mask = chunk->face_masks[threed_to_oned(column.x, y, column.y, chunk_width, chunk_height)];
+				for (u32 f = 0; f < NUM_FACES; f++) {
+					face_counts[f] += (mask >> f) & 1;
+				}
+				visible++;
+
+				min_y = y < min_y ? y : min_y;
+				max_y = y > max_y ? y : max_y;
+			}
+		}
+	}
+	chunk->min_y = visible ? min_y : 0;
+	chunk->max_y = max_y;
+
+	u32 cursors[NUM_FACES];
+	chunk->face_offsets[0] = 0;
+	for (u32 f = 0; f < NUM_FACES; f++) {
+		cursors[f] = chunk->face_offsets[f];
+		chunk->face_offsets[f + 1] = chunk->face_offsets[f] + face_counts[f];
+	}
+	u64 instances = chunk->face_offsets[NUM_FACES];
+
+	if (instances > chunk->instance_capacity) {
+		u64 capacity = chunk->instance_capacity ? chunk->instance_capacity : 64;
+		while (capacity < instances) {
+			capacity *= 2;
+		}
+		chunk->instances = (u32 *)realloc(chunk->instances, sizeof(u32) * capacity);
+		chunk->instance_capacity = capacity;
+	}
+	cell_map_reset(&chunk->mappings, instances);
+
+	for (u32 c = 0; c < chunk_width * chunk_depth; c++) {
+		Point column = oned_to_twod(c, chunk_width);
+		for (u32 w = 0; w < COLUMN_WORDS; w++) {
+			u64 marked = chunk->hull_bits[c * COLUMN_WORDS + w];
+			if (!marked) {
+				continue;
+			}
+
+			u8 word_faces = 0;
+			for (u64 bits = marked; bits; bits &= bits - 1) {
+				u32 y = w * 64 + __builtin_ctzl(bits);
+				word_faces |= chunk->face_masks[threed_to_oned(column.x, y, column.y, chunk_width, chunk_height)];
+			}
+			FaceAO ao[NUM_FACES];
+			column_word_ao(chunk, column.x, column.y, w, word_faces, ao);
+
+			for (u64 bits = marked; bits; bits &= bits - 1) {
+				u32 b = __builtin_ctzl(bits);
+				u32 y = w * 64 + b;
+				u32 i = threed_to_oned(column.x, y, column.y, chunk_width, chunk_height);
+				u8 tile_id = chunk->pre_render_list[i];
+
+				u8 mask = chunk->face_masks[i];
+				for (u32 f = 0; f < NUM_FACES; f++) {
+					if ((mask >> f) & 1) {
+						u32 tile_index = cursors[f]++;
+						chunk->instances[tile_index] = pack_instance(column.x, y, column.y, tile_id, cell_ao(&ao[f], b));
+						cell_map_insert(&chunk->mappings, face_key(i, f), tile_index);
+					}
+				}
+			}
+		}
+	}
+
+	chunk->num_blocks = visible;
+	chunk->num_instances = instances;
+	chunk->dirty = true;
+	chunk->mesh_dirty = true;
+}
+
+// Heap bytes owned by the chunk, including the struct itself
+u64 chunk_memory_usage(Chunk *chunk) {
+	u64 bytes = sizeof(Chunk);
+	bytes += chunk_size * 2;
+	bytes += chunk_width * chunk_depth * COLUMN_WORDS * sizeof(u64) * 2;
+	bytes += chunk_width * chunk_depth;
+	bytes += chunk->instance_capacity * sizeof(u32);
+	bytes += cell_map_memory_usage(&chunk->mappings);
+	return bytes;
+}
+
+u64 world_memory_usage(Chunk **chunks) {
+	u64 bytes = 0;
+	for (u32 i = 0; i < num_chunks; i++) {
+		if (chunks[i]) {
+			bytes += chunk_memory_usage(chunks[i]);
+		}
+	}
+	return bytes;
+}
+
+void free_chunk(Chunk *chunk) {
+	free(chunk->instances);
+	free_cell_map(&chunk->mappings);
+	free(chunk->pre_render_list);
+	free(chunk->face_masks);
+	free(chunk->occupancy);
+	free(chunk->hull_bits);
+	free(chunk->real_blocks);
+	free(chunk);
+}
+
+#endif
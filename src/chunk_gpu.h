@@ -0,0 +1,485 @@
+#ifndef CHUNK_GPU_H
+#define CHUNK_GPU_H
+
+#include "common.h"
+#include "chunk.h"
+#include "mesher.h"
+#include "lod.h"
+#include "trace.h"
+#include "gl_helper.h"
+#include "ring_buffer.h"
+#include "cube.h"
+
+// Persistent GPU copies of each chunk's instance data and greedy mesh.
+// update_chunk marks a chunk dirty; the upload functions refresh only dirty
+// chunks, and spread the work over several frames once the per-frame byte
+// budget runs out. Callers clear UploadStats at the start of each frame.
+//
+// Every chunk's instances live in one shared buffer, each chunk in a range
+// of it, so the instanced chunks are drawn from a list of commands built on
+// the CPU: with one glMultiDrawElementsIndirect where the context has it,
+// else one base-instance draw per command, else one draw per command after
+// pointing the instance attribute at its range. The chunk's origin comes
+// from base_vertex, which picks that slot's copy of the cube corners, so
+// nothing is rebound and no uniform changes between chunks.
+//
+// Uploads and the draw commands are written into the frame's region of the
+// streaming ring, see ring_buffer.h, and copied from there on the GPU.
+
+typedef enum RenderMode {
+	RENDER_INSTANCED,
+	RENDER_GREEDY_MESH,
+} RenderMode;
+
+typedef struct ChunkBuffers {
+	// Range of the instance pool, in instances
+	u32 instance_offset;
+	u64 capacity;
+	u64 num_instances;
+	u32 face_offsets[NUM_FACES + 1];
+	// Origin of the chunk the instances were uploaded from
+	i32 x_off;
+	i32 z_off;
+
+	GLuint vbo_mesh;
+	GLuint ibo_mesh;
+	u32 mesh_vertex_capacity;
+	u32 mesh_index_capacity;
+	u32 num_mesh_indices;
+	// Level the mesh buffers were built at, see lod.h
+	u32 mesh_level;
+} ChunkBuffers;
+
+typedef struct UploadStats {
+	u64 bytes_uploaded;
+	u32 buffers_reallocated;
+	u32 chunks_uploaded;
+	u32 chunks_pending;
+} UploadStats;
+
+u64 upload_budget_bytes = 4 * 1024 * 1024;
+
+typedef struct InstanceRange {
+	u32 offset;
+	u32 size;
+} InstanceRange;
+
+// One buffer of instances, handed out in ranges first fit. It doubles when
+// no free range is large enough, copying everything over on the GPU, so
+// ranges keep their offsets.
+typedef struct InstancePool {
+	GLuint vbo;
+	// In instances
+	u32 capacity;
+	u32 used;
+	// Sorted by offset, and never touching each other
+	InstanceRange *free_ranges;
+	u32 num_free;
+	u32 free_capacity;
+} InstancePool;
+
+// Returns the range [offset, offset + size) to the free list, merging it
+// with the free ranges on either side
+void release_instances(InstancePool *pool, u32 offset, u32 size) {
+	u32 i = 0;
+	while (i < pool->num_free && pool->free_ranges[i].offset < offset) {
+		i++;
+	}
+
+	bool joins_prev = i > 0 && pool->free_ranges[i - 1].offset + pool->free_ranges[i - 1].size == offset;
+	bool joins_next = i < pool->num_free && offset + size == pool->free_ranges[i].offset;
+	if (joins_prev && joins_next) {
+		pool->free_ranges[i - 1].size += size + pool->free_ranges[i].size;
+		memmove(&pool->free_ranges[i], &pool->free_ranges[i + 1], sizeof(InstanceRange) * (pool->num_free - i - 1));
+		pool->num_free--;
+	} else if (joins_prev) {
+		pool->free_ranges[i - 1].size += size;
+	} else if (joins_next) {
+		pool->free_ranges[i].offset = offset;
+		pool->free_ranges[i].size += size;
+	} else {
+		if (pool->num_free == pool->free_capacity) {
+			pool->free_capacity = pool->free_capacity ? pool->free_capacity * 2 : 64;
+			pool->free_ranges = (InstanceRange *)realloc(pool->free_ranges, sizeof(InstanceRange) * pool->free_capacity);
+		}
+		memmove(&pool->free_ranges[i + 1], &pool->free_ranges[i], sizeof(InstanceRange) * (pool->num_free - i));
+		pool->free_ranges[i].offset = offset;
+		pool->free_ranges[i].size = size;
+		pool->num_free++;
+	}
+}
+
+void grow_instance_pool(InstancePool *pool, u32 capacity, UploadStats *stats) {
+	GLuint vbo;
+	GL_CHECK(glGenBuffers(1, &vbo));
+	GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, vbo));
+	GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, sizeof(u32) * capacity, NULL, GL_DYNAMIC_DRAW));
+	if (pool->capacity > 0) {
+		GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, pool->vbo));
+		GL_CHECK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(u32) * pool->capacity));
+		GL_CHECK(glDeleteBuffers(1, &pool->vbo));
+	}
+
+	release_instances(pool, pool->capacity, capacity - pool->capacity);
+	pool->vbo = vbo;
+	pool->capacity = capacity;
+	if (stats) {
+		stats->buffers_reallocated++;
+	}
+}
+
+void init_instance_pool(InstancePool *pool, u32 capacity) {
+	memset(pool, 0, sizeof(InstancePool));
+	grow_instance_pool(pool, capacity, NULL);
+}
+
+u32 alloc_instances(InstancePool *pool, u32 size, UploadStats *stats) {
+	for (;;) {
+		for (u32 i = 0; i < pool->num_free; i++) {
+			InstanceRange *range = &pool->free_ranges[i];
+			if (range->size < size) {
+				continue;
+			}
+
+			u32 offset = range->offset;
+			range->offset += size;
+			range->size -= size;
+			if (range->size == 0) {
+				memmove(range, range + 1, sizeof(InstanceRange) * (pool->num_free - i - 1));
+				pool->num_free--;
+			}
+			pool->used += size;
+			return offset;
+		}
+
+		u32 capacity = pool->capacity * 2;
+		while (capacity < pool->used + size) {
+			capacity *= 2;
+		}
+		grow_instance_pool(pool, capacity, stats);
+	}
+}
+
+void free_instances(InstancePool *pool, u32 offset, u32 size) {
+	release_instances(pool, offset, size);
+	pool->used -= size;
+}
+
+void free_instance_pool(InstancePool *pool) {
+	GL_CHECK(glDeleteBuffers(1, &pool->vbo));
+	free(pool->free_ranges);
+	memset(pool, 0, sizeof(InstancePool));
+}
+
+ChunkBuffers *create_chunk_buffers(u32 count) {
+	ChunkBuffers *buffers = (ChunkBuffers *)malloc(sizeof(ChunkBuffers) * count);
+	memset(buffers, 0, sizeof(ChunkBuffers) * count);
+
+	for (u32 i = 0; i < count; i++) {
+		glGenBuffers(1, &buffers[i].vbo_mesh);
+		glGenBuffers(1, &buffers[i].ibo_mesh);
+	}
+
+	return buffers;
+}
+
+void upload_chunk(InstancePool *pool, RingBuffer *ring, Chunk *chunk, ChunkBuffers *buffers, UploadStats *stats) {
+	TRACE_SCOPE("upload_chunk");
+	u64 bytes = sizeof(u32) * chunk->num_instances;
+
+	// A range only grows, to the chunk's CPU capacity, so small edits never
+	// move it
+	if (chunk->num_instances > buffers->capacity) {
+		if (buffers->capacity > 0) {
+			free_instances(pool, buffers->instance_offset, buffers->capacity);
+		}
+		buffers->capacity = chunk->instance_capacity;
+		buffers->instance_offset = alloc_instances(pool, buffers->capacity, stats);
+	}
+
+	ring_upload(ring, pool->vbo, sizeof(u32) * buffers->instance_offset, chunk->instances, bytes);
+
+	buffers->num_instances = chunk->num_instances;
+	buffers->x_off = chunk->x_off;
+	buffers->z_off = chunk->z_off;
+	memcpy(buffers->face_offsets, chunk->face_offsets, sizeof(buffers->face_offsets));
+	chunk->dirty = false;
+
+	stats->bytes_uploaded += bytes;
+	stats->chunks_uploaded++;
+}
+
+// Always uploads at least one dirty chunk, so a chunk larger than the
+// budget still makes progress. Chunks that are not visible, or are drawn from
+// a lower detail mesh, stay dirty until they are needed.
+void upload_dirty_chunks(InstancePool *pool, RingBuffer *ring, Chunk **chunks, ChunkBuffers *buffers, u8 *visible, u8 *levels, u32 count, UploadStats *stats) {
+	for (u32 i = 0; i < count; i++) {
+		if (!visible[i] || levels[i] > 0 || !chunks[i]->dirty) {
+			continue;
+		}
+
+		if (stats->chunks_uploaded > 0 && stats->bytes_uploaded + sizeof(u32) * chunks[i]->num_instances > upload_budget_bytes) {
+			stats->chunks_pending++;
+			continue;
+		}
+
+		upload_chunk(pool, ring, chunks[i], &buffers[i], stats);
+	}
+}
+
+void upload_chunk_mesh(RingBuffer *ring, Chunk *chunk, ChunkMesh *mesh, ChunkBuffers *buffers, UploadStats *stats) {
+	TRACE_SCOPE("upload_chunk_mesh");
+	u64 vertex_bytes = sizeof(MeshVertex) * mesh->num_vertices;
+	u64 index_bytes = sizeof(u32) * mesh->num_indices;
+
+	if (mesh->num_vertices > buffers->mesh_vertex_capacity) {
+		buffers->mesh_vertex_capacity = mesh->vertex_capacity;
+		GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, buffers->vbo_mesh));
+		GL_CHECK(glBufferData(GL_ARRAY_BUFFER, sizeof(MeshVertex) * buffers->mesh_vertex_capacity, NULL, GL_DYNAMIC_DRAW));
+		stats->buffers_reallocated++;
+	}
+	ring_upload(ring, buffers->vbo_mesh, 0, mesh->vertices, vertex_bytes);
+
+	if (mesh->num_indices > buffers->mesh_index_capacity) {
+		buffers->mesh_index_capacity = mesh->index_capacity;
+		GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers->ibo_mesh));
+		GL_CHECK(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(u32) * buffers->mesh_index_capacity, NULL, GL_DYNAMIC_DRAW));
+		stats->buffers_reallocated++;
+	}
+	ring_upload(ring, buffers->ibo_mesh, 0, mesh->indices, index_bytes);
+
+	buffers->num_mesh_indices = mesh->num_indices;
+	chunk->mesh_dirty = false;
+
+	stats->bytes_uploaded += vertex_bytes + index_bytes;
+	stats->chunks_uploaded++;
+}
+
+// Meshes are only built for chunks drawn from them: every level when the
+// greedy mode is active, otherwise just the lower detail levels from
+// min_level up. A chunk is rebuilt when its data changed or it moved to
+// another level, under the same budget as upload_dirty_chunks.
+// May leave the element array binding pointing at a mesh it uploaded.
+void upload_dirty_meshes(RingBuffer *ring, Chunk **chunks, ChunkMesh *meshes, ChunkBuffers *buffers, u8 *visible, u8 *levels, u32 min_level, u32 count, UploadStats *stats) {
+	for (u32 i = 0; i < count; i++) {
+		if (!visible[i] || levels[i] < min_level) {
+			continue;
+		}
+		if (!chunks[i]->mesh_dirty && buffers[i].mesh_level == levels[i]) {
+			continue;
+		}
+
+		if (stats->chunks_uploaded > 0 && stats->bytes_uploaded >= upload_budget_bytes) {
+			stats->chunks_pending++;
+			continue;
+		}
+
+		if (levels[i] > 0) {
+			mesh_chunk_lod(chunks, i, levels[i], &meshes[i]);
+		} else {
+			mesh_chunk(chunks, i, &meshes[i]);
+		}
+		upload_chunk_mesh(ring, chunks[i], &meshes[i], &buffers[i], stats);
+		buffers[i].mesh_level = levels[i];
+	}
+}
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+typedef void (GL_HELPER_APIENTRY *GlMultiDrawElementsIndirectFunc)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+typedef void (GL_HELPER_APIENTRY *GlDrawElementsInstancedBaseVertexBaseInstanceFunc)(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instancecount, GLint basevertex, GLuint baseinstance);
+
+typedef enum DrawPath {
+	DRAW_ATTRIB_OFFSET,
+	DRAW_BASE_INSTANCE,
+	DRAW_MULTI_INDIRECT,
+} DrawPath;
+
+const char *draw_path_names[] = {"attribute offsets", "base instance", "multi draw indirect"};
+
+// Laid out as DrawElementsIndirectCommand
+typedef struct DrawCommand {
+	u32 count;
+	u32 instance_count;
+	u32 first_index;
+	i32 base_vertex;
+	u32 base_instance;
+} DrawCommand;
+
+typedef struct ChunkDraws {
+	DrawPath path;
+	GlMultiDrawElementsIndirectFunc multi_draw_indirect;
+	GlDrawElementsInstancedBaseVertexBaseInstanceFunc draw_base_instance;
+
+	// cube_points once per slot, moved to the origin of the chunk whose
+	// instances the slot holds
+	GLuint vbo_slot_points;
+	i32 *slot_x;
+	i32 *slot_z;
+	u8 *slot_placed;
+	u32 num_slots;
+
+	// Used when the commands are not in the ring
+	DrawCommand *commands;
+	u32 num_commands;
+	GLuint indirect_buffer;
+} ChunkDraws;
+
+// Takes the best path the context has, but none above max_path
+void init_chunk_draws(ChunkDraws *draws, u32 num_slots, DrawPath max_path) {
+	memset(draws, 0, sizeof(ChunkDraws));
+
+	u32 version = gl_version();
+	bool has_base_instance = version >= 42 || gl_has_extension("GL_ARB_base_instance");
+	bool has_multi_indirect = has_base_instance && (version >= 43 || gl_has_extension("GL_ARB_multi_draw_indirect"));
+
+	if (has_base_instance) {
+		draws->draw_base_instance = (GlDrawElementsInstancedBaseVertexBaseInstanceFunc)gl_proc_address("glDrawElementsInstancedBaseVertexBaseInstance");
+	}
+	if (has_multi_indirect) {
+		draws->multi_draw_indirect = (GlMultiDrawElementsIndirectFunc)gl_proc_address("glMultiDrawElementsIndirect");
+	}
+
+	draws->path = DRAW_ATTRIB_OFFSET;
+	if (draws->draw_base_instance && max_path >= DRAW_BASE_INSTANCE) {
+		draws->path = DRAW_BASE_INSTANCE;
+	}
+	if (draws->multi_draw_indirect && max_path >= DRAW_MULTI_INDIRECT) {
+		draws->path = DRAW_MULTI_INDIRECT;
+		GL_CHECK(glGenBuffers(1, &draws->indirect_buffer));
+	}
+
+	draws->num_slots = num_slots;
+	draws->slot_x = (i32 *)calloc(num_slots, sizeof(i32));
+	draws->slot_z = (i32 *)calloc(num_slots, sizeof(i32));
+	draws->slot_placed = (u8 *)calloc(num_slots, 1);
+	// At most one command per face of every slot
+	draws->commands = (DrawCommand *)malloc(sizeof(DrawCommand) * num_slots * NUM_FACES);
+
+	GL_CHECK(glGenBuffers(1, &draws->vbo_slot_points));
+	GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, draws->vbo_slot_points));
+	GL_CHECK(glBufferData(GL_ARRAY_BUFFER, sizeof(cube_points) * num_slots, NULL, GL_DYNAMIC_DRAW));
+}
+
+// Moves the slot's corners to (x, z)
+void place_slot(ChunkDraws *draws, u32 slot, i32 x, i32 z) {
+	GLfloat points[sizeof(cube_points) / sizeof(GLfloat)];
+	for (u32 i = 0; i < sizeof(cube_points) / sizeof(GLfloat); i += 3) {
+		points[i] = cube_points[i] + (GLfloat)x;
+		points[i + 1] = cube_points[i + 1];
+		points[i + 2] = cube_points[i + 2] + (GLfloat)z;
+	}
+
+	GL_CHECK(glBufferSubData(GL_ARRAY_BUFFER, sizeof(cube_points) * slot, sizeof(cube_points), points));
+	draws->slot_x[slot] = x;
+	draws->slot_z[slot] = z;
+	draws->slot_placed[slot] = true;
+}
+
+// Draws every visible chunk at full detail from the instance pool, with one
+// command per face direction drawing only that face's two triangles out of
+// cube_indices. Expects the cube program in use with chunk_offset at zero,
+// and cube_indices bound as the element array. Leaves points_attr and
+// instance_attr pointing into the slot points and the pool.
+void draw_chunk_instances(ChunkDraws *draws, InstancePool *pool, RingBuffer *ring, ChunkBuffers *buffers, u8 *visible, u8 *levels, u32 count, GLuint points_attr, GLuint instance_attr) {
+	TRACE_SCOPE("draw_chunk_instances");
+
+	// Indirect commands are written straight into the ring, room for the
+	// most there can be
+	DrawCommand *commands = draws->commands;
+	u64 ring_offset = 0;
+	bool in_ring = false;
+	if (draws->path == DRAW_MULTI_INDIRECT) {
+		DrawCommand *mapped = (DrawCommand *)ring_alloc(ring, sizeof(DrawCommand) * draws->num_slots * NUM_FACES, &ring_offset);
+		if (mapped) {
+			commands = mapped;
+			in_ring = true;
+		}
+	}
+
+	GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, draws->vbo_slot_points));
+	draws->num_commands = 0;
+	for (u32 i = 0; i < count; i++) {
+		ChunkBuffers *chunk = &buffers[i];
+		if (!visible[i] || levels[i] > 0 || chunk->num_instances == 0) {
+			continue;
+		}
+
+		if (!draws->slot_placed[i] || draws->slot_x[i] != chunk->x_off || draws->slot_z[i] != chunk->z_off) {
+			place_slot(draws, i, chunk->x_off, chunk->z_off);
+		}
+
+		for (u32 f = 0; f < NUM_FACES; f++) {
+			u32 num = chunk->face_offsets[f + 1] - chunk->face_offsets[f];
+			if (num == 0) {
+				continue;
+			}
+
+			DrawCommand *command = &commands[draws->num_commands++];
+			command->count = 6;
+			command->instance_count = num;
+			command->first_index = 6 * f;
+			command->base_vertex = 24 * i;
+			command->base_instance = chunk->instance_offset + chunk->face_offsets[f];
+		}
+	}
+
+	if (in_ring) {
+		ring_commit(ring);
+	}
+
+	GL_CHECK(glVertexAttribPointer(points_attr, 3, GL_FLOAT, GL_FALSE, 0, 0));
+	GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, pool->vbo));
+	GL_CHECK(glVertexAttribIPointer(instance_attr, 1, GL_UNSIGNED_INT, 0, 0));
+	if (draws->num_commands == 0) {
+		return;
+	}
+
+	if (in_ring) {
+		GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring->buffer));
+		GL_CHECK(draws->multi_draw_indirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, (void *)ring_offset, draws->num_commands, 0));
+		GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+	} else if (draws->path == DRAW_MULTI_INDIRECT) {
+		// Orphaned every frame, so the driver never waits on last frame's
+		GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, draws->indirect_buffer));
+		GL_CHECK(glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand) * draws->num_commands, draws->commands, GL_STREAM_DRAW));
+		GL_CHECK(draws->multi_draw_indirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, NULL, draws->num_commands, 0));
+		GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+	} else if (draws->path == DRAW_BASE_INSTANCE) {
+		for (u32 c = 0; c < draws->num_commands; c++) {
+			DrawCommand *command = &draws->commands[c];
+			void *indices = (void *)(sizeof(GLushort) * command->first_index);
+			GL_CHECK(draws->draw_base_instance(GL_TRIANGLES, command->count, GL_UNSIGNED_SHORT, indices, command->instance_count, command->base_vertex, command->base_instance));
+		}
+	} else {
+		for (u32 c = 0; c < draws->num_commands; c++) {
+			DrawCommand *command = &draws->commands[c];
+			void *indices = (void *)(sizeof(GLushort) * command->first_index);
+			GL_CHECK(glVertexAttribIPointer(instance_attr, 1, GL_UNSIGNED_INT, 0, (void *)(sizeof(u32) * (u64)command->base_instance)));
+			GL_CHECK(glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command->count, GL_UNSIGNED_SHORT, indices, command->instance_count, command->base_vertex));
+		}
+	}
+}
+
+void free_chunk_draws(ChunkDraws *draws) {
+	GL_CHECK(glDeleteBuffers(1, &draws->vbo_slot_points));
+	if (draws->indirect_buffer) {
+		GL_CHECK(glDeleteBuffers(1, &draws->indirect_buffer));
+	}
+	free(draws->slot_x);
+	free(draws->slot_z);
+	free(draws->slot_placed);
+	free(draws->commands);
+}
+
+void free_chunk_buffers(ChunkBuffers *buffers, u32 count) {
+	for (u32 i = 0; i < count; i++) {
+		glDeleteBuffers(1, &buffers[i].vbo_mesh);
+		glDeleteBuffers(1, &buffers[i].ibo_mesh);
+	}
+	free(buffers);
+}
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef CHUNK_MAP_H
+#define CHUNK_MAP_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "chunk.h"
+
+// Open-addressing (linear probing) map from signed chunk coordinates to
+// chunks, for worlds that are sparse or move around the camera. Inserting and
+// removing a chunk also links and unlinks it with its loaded neighbours, so
+// hulling follows Chunk::neighbours instead of looking anything up.
+//
+// Chunks the owner is done with can be released onto an LRU list instead of
+// being freed; chunk_map_evict trims that list oldest first and hands every
+// evicted chunk to a hook, which decides what happens to it.
+
+typedef void (*ChunkEvictFunc)(Chunk *chunk, void *data);
+
+typedef struct ChunkMap {
+	u64 *keys;
+	// NULL marks an empty slot, so every key is usable
+	Chunk **values;
+	u32 capacity;
+	u32 count;
+
+	// Released chunks, least recently used first
+	Chunk *lru_head;
+	Chunk *lru_tail;
+	u32 lru_count;
+} ChunkMap;
+
+u64 chunk_key(i32 cx, i32 cz) {
+	return ((u64)(u32)cx << 32) | (u32)cz;
+}
+
+u64 chunk_key_of(Chunk *chunk) {
+	return chunk_key(chunk->x_off / (i32)chunk_width, chunk->z_off / (i32)chunk_depth);
+}
+
+u32 chunk_map_slot(ChunkMap *map, u64 key) {
+	// Both halves matter, so fold them together before taking the low bits
+	u32 h = (u32)(key >> 32) * 0x9e3779b1u ^ (u32)key * 0x85ebca77u;
+	return (h ^ (h >> 16)) & (map->capacity - 1);
+}
+
+// Empties the map, growing it so expected entries stay under half load
+void chunk_map_reset(ChunkMap *map, u32 expected) {
+	u32 capacity = map->capacity ? map->capacity : 16;
+	while (capacity < expected * 2) {
+		capacity *= 2;
+	}
+
+	if (capacity != map->capacity) {
+		free(map->keys);
+		free(map->values);
+		map->keys = (u64 *)malloc(sizeof(u64) * capacity);
+		map->values = (Chunk **)malloc(sizeof(Chunk *) * capacity);
+		map->capacity = capacity;
+	}
+
+	memset(map->values, 0, sizeof(Chunk *) * map->capacity);
+	map->count = 0;
+	map->lru_head = NULL;
+	map->lru_tail = NULL;
+	map->lru_count = 0;
+}
+
+void chunk_map_put(ChunkMap *map, u64 key, Chunk *chunk) {
+	if ((map->count + 1) * 2 > map->capacity) {
+		ChunkMap grown = {};
+		chunk_map_reset(&grown, map->count + 1);
+		for (u32 i = 0; i < map->capacity; i++) {
+			if (map->values[i]) {
+				chunk_map_put(&grown, map->keys[i], map->values[i]);
+			}
+		}
+		free(map->keys);
+		free(map->values);
+		map->keys = grown.keys;
+		map->values = grown.values;
+		map->capacity = grown.capacity;
+	}
+
+	u32 slot = chunk_map_slot(map, key);
+	while (map->values[slot] && map->keys[slot] != key) {
+		slot = (slot + 1) & (map->capacity - 1);
+	}
+
+	if (!map->values[slot]) {
+		map->count++;
+	}
+	map->keys[slot] = key;
+	map->values[slot] = chunk;
+}
+
+Chunk *chunk_map_find(ChunkMap *map, i32 cx, i32 cz) {
+	if (map->capacity == 0) {
+		return NULL;
+	}
+
+	u64 key = chunk_key(cx, cz);
+	u32 slot = chunk_map_slot(map, key);
+	while (map->values[slot]) {
+		if (map->keys[slot] == key) {
+			return map->values[slot];
+		}
+		slot = (slot + 1) & (map->capacity - 1);
+	}
+	return NULL;
+}
+
+// Adds the chunk and links it with the neighbours already in the map. A new
+// chunk is in use, not on the LRU list.
+void chunk_map_insert(ChunkMap *map, Chunk *chunk) {
+	i32 cx = chunk->x_off / (i32)chunk_width;
+	i32 cz = chunk->z_off / (i32)chunk_depth;
+	chunk_map_put(map, chunk_key(cx, cz), chunk);
+
+	u32 sides[4] = {FACE_FRONT, FACE_BACK, FACE_LEFT, FACE_RIGHT};
+	for (u32 s = 0; s < 4; s++) {
+		i32 *n = face_normals[sides[s]];
+		Chunk *neighbour = chunk_map_find(map, cx + n[0], cz + n[2]);
+		chunk->neighbours[sides[s]] = neighbour;
+		if (neighbour) {
+			neighbour->neighbours[opposite_faces[sides[s]]] = chunk;
+		}
+	}
+}
+
+void lru_unlink(ChunkMap *map, Chunk *chunk) {
+	if (!chunk->in_lru) {
+		return;
+	}
+
+	if (chunk->lru_prev) {
+		chunk->lru_prev->lru_next = chunk->lru_next;
+	} else {
+		map->lru_head = chunk->lru_next;
+	}
+	if (chunk->lru_next) {
+		chunk->lru_next->lru_prev = chunk->lru_prev;
+	} else {
+		map->lru_tail = chunk->lru_prev;
+	}
+
+	chunk->lru_prev = NULL;
+	chunk->lru_next = NULL;
+	chunk->in_lru = false;
+	map->lru_count--;
+}
+
+// Backward-shift deletion, so lookups never need tombstones. Unlinks the
+// chunk from its neighbours and the LRU list but does not free it.
+void chunk_map_remove(ChunkMap *map, Chunk *chunk) {
+	u64 key = chunk_key_of(chunk);
+	u32 mask = map->capacity - 1;
+	u32 slot = chunk_map_slot(map, key);
+	while (map->values[slot] != chunk) {
+		if (!map->values[slot]) {
+			return;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	u32 hole = slot;
+	u32 next = (hole + 1) & mask;
+	while (map->values[next]) {
+		u32 home = chunk_map_slot(map, map->keys[next]);
+		// The entry may move into the hole unless its home lies cyclically
+		// between the hole and its current slot
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			map->keys[hole] = map->keys[next];
+			map->values[hole] = map->values[next];
+			hole = next;
+		}
+		next = (next + 1) & mask;
+	}
+
+	map->values[hole] = NULL;
+	map->count--;
+
+	for (u32 f = 0; f < NUM_FACES; f++) {
+		if (chunk->neighbours[f]) {
+			chunk->neighbours[f]->neighbours[opposite_faces[f]] = NULL;
+			chunk->neighbours[f] = NULL;
+		}
+	}
+	lru_unlink(map, chunk);
+}
+
+// Marks the chunk unused, making it the last to be evicted
+void chunk_map_release(ChunkMap *map, Chunk *chunk) {
+	lru_unlink(map, chunk);
+
+	chunk->lru_prev = map->lru_tail;
+	chunk->lru_next = NULL;
+	if (map->lru_tail) {
+		map->lru_tail->lru_next = chunk;
+	} else {
+		map->lru_head = chunk;
+	}
+	map->lru_tail = chunk;
+	chunk->in_lru = true;
+	map->lru_count++;
+}
+
+// Marks a released chunk in use again, so it cannot be evicted
+void chunk_map_acquire(ChunkMap *map, Chunk *chunk) {
+	lru_unlink(map, chunk);
+}
+
+// Removes released chunks, least recently used first, until at most
+// max_released are left, passing each one to hook once it is out of the map
+u32 chunk_map_evict(ChunkMap *map, u32 max_released, ChunkEvictFunc hook, void *data) {
+	u32 evicted = 0;
+	while (map->lru_count > max_released) {
+		Chunk *chunk = map->lru_head;
+		chunk_map_remove(map, chunk);
+		hook(chunk, data);
+		evicted++;
+	}
+	return evicted;
+}
+
+u64 chunk_map_memory_usage(ChunkMap *map) {
+	return (u64)map->capacity * (sizeof(u64) + sizeof(Chunk *));
+}
+
+// Frees the table only; the chunks belong to the caller
+void free_chunk_map(ChunkMap *map) {
+	free(map->keys);
+	free(map->values);
+	memset(map, 0, sizeof(ChunkMap));
+}
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "chunk.h"
+
+// Per-frame chunk frustum culling. Chunk boxes are kept as structure of
+// arrays in center/extent form, so the plane tests are straight-line float
+// loops over every chunk that the compiler can vectorize.
+
+typedef struct Frustum {
+	// (normal, distance), pointing inwards: inside when dot(n, p) + d >= 0
+	glm::vec4 planes[6];
+} Frustum;
+
+typedef struct ChunkBounds {
+	f32 *center_x;
+	f32 *center_y;
+	f32 *center_z;
+	f32 *extent_x;
+	f32 *extent_y;
+	f32 *extent_z;
+	u32 count;
+} ChunkBounds;
+
+typedef struct CullStats {
+	u32 drawn;
+	u32 culled;
+	u32 occluded;
+} CullStats;
+
+// Gribb/Hartmann plane extraction from the rows of the clip matrix
+Frustum frustum_from_matrix(glm::mat4 pv) {
+	Frustum frustum;
+
+	glm::vec4 rows[4];
+	for (u32 r = 0; r < 4; r++) {
+		rows[r] = glm::vec4(pv[0][r], pv[1][r], pv[2][r], pv[3][r]);
+	}
+
+	frustum.planes[0] = rows[3] + rows[0];
+	frustum.planes[1] = rows[3] - rows[0];
+	frustum.planes[2] = rows[3] + rows[1];
+	frustum.planes[3] = rows[3] - rows[1];
+	frustum.planes[4] = rows[3] + rows[2];
+	frustum.planes[5] = rows[3] - rows[2];
+
+	return frustum;
+}
+
+ChunkBounds create_chunk_bounds(u32 count) {
+	ChunkBounds bounds;
+	f32 *data = (f32 *)calloc(count * 6, sizeof(f32));
+	bounds.center_x = data;
+	bounds.center_y = data + count;
+	bounds.center_z = data + count * 2;
+	bounds.extent_x = data + count * 3;
+	bounds.extent_y = data + count * 4;
+	bounds.extent_z = data + count * 5;
+	bounds.count = count;
+	return bounds;
+}
+
+void set_chunk_bounds(ChunkBounds *bounds, u32 idx, Chunk *chunk) {
+	f32 min_y = chunk->min_y;
+	f32 max_y = chunk->max_y + 1;
+
+	bounds->extent_x[idx] = chunk_width * 0.5f;
+	bounds->extent_y[idx] = (max_y - min_y) * 0.5f;
+	bounds->extent_z[idx] = chunk_depth * 0.5f;
+	bounds->center_x[idx] = chunk->x_off + bounds->extent_x[idx];
+	bounds->center_y[idx] = min_y + bounds->extent_y[idx];
+	bounds->center_z[idx] = chunk->z_off + bounds->extent_z[idx];
+}
+
+// Empty box at the bottom of the world, for slots without a drawable chunk
+void clear_chunk_bounds(ChunkBounds *bounds, u32 idx) {
+	bounds->center_x[idx] = 0.0f;
+	bounds->center_y[idx] = -1.0f;
+	bounds->center_z[idx] = 0.0f;
+	bounds->extent_x[idx] = 0.0f;
+	bounds->extent_y[idx] = 0.0f;
+	bounds->extent_z[idx] = 0.0f;
+}
+
+// Sets visible[i] for every box that is not fully outside one of the planes,
+// returning the number of visible boxes
+u32 cull_chunks(ChunkBounds *bounds, Frustum *frustum, u8 *visible) {
+	u32 count = bounds->count;
+	memset(visible, 1, count);
+
+	for (u32 p = 0; p < 6; p++) {
+		glm::vec4 plane = frustum->planes[p];
+		f32 nx = plane.x;
+		f32 ny = plane.y;
+		f32 nz = plane.z;
+		f32 ax = fabsf(nx);
+		f32 ay = fabsf(ny);
+		f32 az = fabsf(nz);
+		f32 d = plane.w;
+
+		const f32 *cx = bounds->center_x;
+		const f32 *cy = bounds->center_y;
+		const f32 *cz = bounds->center_z;
+		const f32 *ex = bounds->extent_x;
+		const f32 *ey = bounds->extent_y;
+		const f32 *ez = bounds->extent_z;
+
+		for (u32 i = 0; i < count; i++) {
+			f32 dist = nx * cx[i] + ny * cy[i] + nz * cz[i] + d;
+			f32 radius = ax * ex[i] + ay * ey[i] + az * ez[i];
+			visible[i] &= (u8)(dist + radius >= 0.0f);
+		}
+	}
+
+	u32 drawn = 0;
+	for (u32 i = 0; i < count; i++) {
+		drawn += visible[i];
+	}
+	return drawn;
+}
+
+void free_chunk_bounds(ChunkBounds *bounds) {
+	free(bounds->center_x);
+	memset(bounds, 0, sizeof(ChunkBounds));
+}
+
+#endif
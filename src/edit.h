@@ -0,0 +1,193 @@
+#ifndef EDIT_H
+#define EDIT_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "point.h"
+#include "chunk.h"
+#include "cell_map.h"
+
+// Block edits on hulled chunks. An edit changes one cell, and only its
+// column and the eight around it, some of which may be in the neighbouring
+// chunks, are hulled again and have their ambient occlusion redone. Their
+// instances are patched in place through Chunk::mappings rather than rebuilt
+// by update_chunk.
+//
+// Instances stay grouped by face. Removing one moves the last instance of
+// its group into the gap, and then the last instance of every later group
+// into the gap left before it; adding one does the same in reverse. So an
+// edit moves at most one instance per face, though each group's order ends
+// up different from update_chunk's.
+
+// Moves the instance of the given face from one index to another and
+// points its mapping at the new index
+void move_instance(Chunk *chunk, u32 from, u32 to, u32 face) {
+	u32 instance = chunk->instances[from];
+	Point p = unpack_instance(instance);
+	chunk->instances[to] = instance;
+	cell_map_insert(&chunk->mappings, face_key(point_to_oned(p, chunk_width, chunk_height), face), to);
+}
+
+void add_instance(Chunk *chunk, u32 cell, u32 face, u32 instance) {
+	if (chunk->num_instances == chunk->instance_capacity) {
+		chunk->instance_capacity = chunk->instance_capacity ? chunk->instance_capacity * 2 : 64;
+		chunk->instances = (u32 *)realloc(chunk->instances, sizeof(u32) * chunk->instance_capacity);
+	}
+
+	// The free index starts past the last group and ends up past this one
+	u32 *offsets = chunk->face_offsets;
+	for (u32 g = NUM_FACES - 1; g > face; g--) {
+		if (offsets[g] < offsets[g + 1]) {
+			move_instance(chunk, offsets[g], offsets[g + 1], g);
+		}
+	}
+
+	u32 idx = offsets[face + 1];
+	chunk->instances[idx] = instance;
+	cell_map_insert(&chunk->mappings, face_key(cell, face), idx);
+	for (u32 g = face + 1; g <= NUM_FACES; g++) {
+		offsets[g]++;
+	}
+	chunk->num_instances++;
+}
+
+void remove_instance(Chunk *chunk, u32 cell, u32 face) {
+	u32 idx;
+	if (!cell_map_find(&chunk->mappings, face_key(cell, face), &idx)) {
+		return;
+	}
+	cell_map_remove(&chunk->mappings, face_key(cell, face));
+
+	// The gap starts at the removed instance and ends up at the very end
+	u32 *offsets = chunk->face_offsets;
+	u32 hole = idx;
+	for (u32 g = face; g < NUM_FACES; g++) {
+		if (offsets[g] < offsets[g + 1]) {
+			u32 last = offsets[g + 1] - 1;
+			if (last != hole) {
+				move_instance(chunk, last, hole, g);
+			}
+			hole = last;
+		}
+	}
+
+	for (u32 g = face + 1; g <= NUM_FACES; g++) {
+		offsets[g]--;
+	}
+	chunk->num_instances--;
+}
+
+// Hulls one column of a hulled chunk again and brings its instances, block
+// count, bounds and ambient occlusion in line. Only cells marked before or
+// after are visited. Bounds only grow until the next update_chunk.
+void refresh_column(Chunk *chunk, u32 x, u32 z) {
+	u64 *hull = chunk->hull_bits + twod_to_oned(x, z, chunk_width) * COLUMN_WORDS;
+	u64 old_hull[COLUMN_WORDS];
+	memcpy(old_hull, hull, sizeof(old_hull));
+
+	// Instances hold y in 8 bits, so no column is taller than this
+	u8 old_tiles[256];
+	u8 old_masks[256];
+	for (u32 w = 0; w < COLUMN_WORDS; w++) {
+		for (u64 bits = old_hull[w]; bits; bits &= bits - 1) {
+			u32 y = w * 64 + __builtin_ctzl(bits);
+			u32 cell = threed_to_oned(x, y, z, chunk_width, chunk_height);
+			old_tiles[y] = chunk->pre_render_list[cell];
+			old_masks[y] = chunk->face_masks[cell];
+		}
+	}
+
+	hull_column(chunk, x, z);
+
+	for (u32 w = 0; w < COLUMN_WORDS; w++) {
+		if (!(old_hull[w] | hull[w])) {
+			continue;
+		}
+
+		// Cells whose hull did not change can still see their ambient
+		// occlusion change with the cells around them
+		FaceAO ao[NUM_FACES];
+		column_word_ao(chunk, x, z, w, (1 << NUM_FACES) - 1, ao);
+
+		for (u64 bits = old_hull[w] | hull[w]; bits; bits &= bits - 1) {
+			u32 b = __builtin_ctzl(bits);
+			u32 y = w * 64 + b;
+			u32 cell = threed_to_oned(x, y, z, chunk_width, chunk_height);
+			u8 old_tile = (old_hull[w] >> b) & 1 ? old_tiles[y] : 0;
+			u8 old_mask = (old_hull[w] >> b) & 1 ? old_masks[y] : 0;
+			u8 tile_id = chunk->pre_render_list[cell];
+			u8 mask = chunk->face_masks[cell];
+
+			if (tile_id != old_tile || mask != old_mask) {
+				chunk->num_blocks += (tile_id != 0) - (old_tile != 0);
+				if (tile_id) {
+					chunk->min_y = y < chunk->min_y ? y : chunk->min_y;
+					chunk->max_y = y > chunk->max_y ? y : chunk->max_y;
+				}
+			}
+
+			for (u32 f = 0; f < NUM_FACES; f++) {
+				bool was_drawn = (old_mask >> f) & 1;
+				bool drawn = (mask >> f) & 1;
+				u32 instance = pack_instance(x, y, z, tile_id, cell_ao(&ao[f], b));
+				if (was_drawn && !drawn) {
+					remove_instance(chunk, cell, f);
+				} else if (drawn && !was_drawn) {
+					add_instance(chunk, cell, f, instance);
+				} else if (drawn) {
+					u32 idx;
+					if (cell_map_find(&chunk->mappings, face_key(cell, f), &idx) && chunk->instances[idx] != instance) {
+						chunk->instances[idx] = instance;
+					}
+				}
+			}
+		}
+	}
+
+	chunk->dirty = true;
+	chunk->mesh_dirty = true;
+}
+
+// Refreshes every hulled column that reads column (x, z): its four
+// neighbours for their hull and the four diagonal ones for their ambient
+// occlusion, besides the column itself. Neighbouring chunks that are not
+// hulled yet see the change when they are.
+void refresh_around_column(Chunk *chunk, u32 x, u32 z) {
+	for (i32 dz = -1; dz <= 1; dz++) {
+		for (i32 dx = -1; dx <= 1; dx++) {
+			i32 nx = (i32)x + dx;
+			i32 nz = (i32)z + dz;
+			Chunk *target = column_chunk(chunk, &nx, &nz);
+			if (target && target->hulled) {
+				refresh_column(target, nx, nz);
+			}
+		}
+	}
+}
+
+// Adds or removes the block at chunk-local (x, y, z), leaving the rest of
+// its column as it is. Returns false when that changes nothing; the bottom
+// layer cannot be removed.
+bool set_block(Chunk *chunk, u32 x, u32 y, u32 z, bool solid) {
+	if (!inside_chunk(x, y, z) || (!solid && y == 0)) {
+		return false;
+	}
+
+	u64 *column = chunk_column(chunk, x, z);
+	if (column_solid(column, y) == solid) {
+		return false;
+	}
+	column[y / 64] ^= 1ul << (y % 64);
+
+	u8 *height = &chunk->real_blocks[twod_to_oned(x, z, chunk_width)];
+	*height = highest_solid(column);
+	chunk->top = *height > chunk->top ? *height : chunk->top;
+	chunk->saved = false;
+
+	refresh_around_column(chunk, x, z);
+	return true;
+}
+
+#endif
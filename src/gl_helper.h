@@ -1,12 +1,168 @@
 #ifndef GL_HELPER_H
 #define GL_HELPER_H
 
+#include <assert.h>
+#include <string.h>
+#include <atomic>
+
+#include "common.h"
+#include "trace.h"
+
+// GL_CHECK counts the GL calls it wraps per frame. Outside RELEASE it also
+// notes each call site, and errors are reported without stalling: through
+// KHR_debug output when the context has it, otherwise by polling glGetError
+// once per frame in gl_end_frame. Either way the site printed is the last
+// wrapped call before the error was seen, which is exact only when
+// gl_debug_synchronous is on. GL_CHECK_SYNC instead checks glGetError after
+// every call and asserts, which pins down the call but waits on the driver.
 #define RELEASE 0
+#define GL_CHECK_SYNC 0
+
+#define GL_STRINGIFY_(x) #x
+#define GL_STRINGIFY(x) GL_STRINGIFY_(x)
+
 #if RELEASE
-#define GL_CHECK(x) x
+#define GL_CHECK(x) do { x; gl_frame_calls++; } while(0)
+#elif GL_CHECK_SYNC
+#define GL_CHECK(x) do { x; gl_frame_calls++; GLenum err = glGetError(); assert(err == GL_NO_ERROR); } while(0)
+#else
+#define GL_CHECK(x) do { gl_note_call(__FILE__ ":" GL_STRINGIFY(__LINE__) ": " #x); x; } while(0)
+#endif
+
+#ifndef GL_DEBUG_OUTPUT
+#define GL_DEBUG_OUTPUT 0x92E0
+#endif
+#ifndef GL_DEBUG_OUTPUT_SYNCHRONOUS
+#define GL_DEBUG_OUTPUT_SYNCHRONOUS 0x8242
+#endif
+#ifndef GL_DEBUG_TYPE_ERROR
+#define GL_DEBUG_TYPE_ERROR 0x824C
+#endif
+#ifndef GL_DEBUG_SEVERITY_NOTIFICATION
+#define GL_DEBUG_SEVERITY_NOTIFICATION 0x826B
+#endif
+#ifndef GL_DONT_CARE
+#define GL_DONT_CARE 0x1100
+#endif
+
+#ifdef _WIN32
+#define GL_HELPER_APIENTRY __stdcall
+#else
+#define GL_HELPER_APIENTRY
+#endif
+
+// Built with HEADLESS 1 there is no SDL, and entry points come from EGL
+#ifndef HEADLESS
+#define HEADLESS 0
+#endif
+
+void *gl_proc_address(const char *name) {
+#if HEADLESS
+	return (void *)eglGetProcAddress(name);
+#else
+	return SDL_GL_GetProcAddress(name);
+#endif
+}
+
+// Context version as major * 10 + minor, 43 for GL 4.3
+u32 gl_version() {
+	GLint major = 0;
+	GLint minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	return major * 10 + minor;
+}
+
+bool gl_has_extension(const char *name) {
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		if (!strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+typedef void (GL_HELPER_APIENTRY *GlDebugCallback)(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *user);
+typedef void (GL_HELPER_APIENTRY *GlDebugMessageCallbackFunc)(GlDebugCallback callback, const void *user);
+typedef void (GL_HELPER_APIENTRY *GlDebugMessageControlFunc)(GLenum source, GLenum type, GLenum severity, GLsizei count, const GLuint *ids, GLboolean enabled);
+
+typedef struct GlFrameStats {
+	u32 calls;
+	u32 errors;
+} GlFrameStats;
+
+// Calls wrapped since the last gl_end_frame; only the GL thread touches it
+u32 gl_frame_calls = 0;
+// The debug callback may run on a driver thread
+std::atomic<u32> gl_frame_errors(0);
+std::atomic<const char *> gl_last_call("(no GL_CHECK call yet)");
+
+// Set before init_gl_debug to have the driver report errors inside the
+// call that caused them, at some cost
+bool gl_debug_synchronous = false;
+bool gl_debug_output = false;
+
+void gl_note_call(const char *site) {
+	gl_frame_calls++;
+	gl_last_call.store(site, std::memory_order_relaxed);
+}
+
+void GL_HELPER_APIENTRY gl_debug_message(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *user) {
+	if (type == GL_DEBUG_TYPE_ERROR) {
+		gl_frame_errors++;
+		printf("GL error: %s\n    at or before %s\n", message, gl_last_call.load(std::memory_order_relaxed));
+	} else {
+		printf("GL debug: %s\n", message);
+	}
+}
+
+// Turns on debug output if the context supports KHR_debug, returns whether
+// it did. The context should be created with a debug flag, or
+// drivers may report nothing.
+bool init_gl_debug() {
+#if RELEASE || GL_CHECK_SYNC
+	return false;
 #else
-#define GL_CHECK(x) do { x; GLenum err = glGetError(); assert(err == GL_NO_ERROR); } while(0)
+	if (gl_version() < 43 && !gl_has_extension("GL_KHR_debug")) {
+		return false;
+	}
+
+	GlDebugMessageCallbackFunc message_callback = (GlDebugMessageCallbackFunc)gl_proc_address("glDebugMessageCallback");
+	GlDebugMessageControlFunc message_control = (GlDebugMessageControlFunc)gl_proc_address("glDebugMessageControl");
+	if (!message_callback || !message_control) {
+		return false;
+	}
+
+	message_callback(gl_debug_message, NULL);
+	// Notifications are chatty and never errors
+	message_control(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, NULL, GL_FALSE);
+	glEnable(GL_DEBUG_OUTPUT);
+	if (gl_debug_synchronous) {
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	}
+	gl_debug_output = true;
+	return true;
+#endif
+}
+
+// Call once per frame, after its last GL call. Without debug output this is
+// where errors are found, one glGetError round trip per frame plus one per
+// error.
+void gl_end_frame(GlFrameStats *stats) {
+#if !RELEASE && !GL_CHECK_SYNC
+	if (!gl_debug_output) {
+		for (GLenum err = glGetError(); err != GL_NO_ERROR; err = glGetError()) {
+			gl_frame_errors++;
+			printf("GL error 0x%x this frame\n    at or before %s\n", err, gl_last_call.load(std::memory_order_relaxed));
+		}
+	}
 #endif
+	stats->calls = gl_frame_calls;
+	stats->errors = gl_frame_errors.exchange(0);
+	gl_frame_calls = 0;
+}
 
 void get_shader_err(GLuint shader) {
 	GLint err_log_max_length = 0;
@@ -60,4 +216,71 @@ GLuint load_and_build_program(const char *vert_filename, const char *frag_filena
 	return shader_program;
 }
 
+#if TRACING
+#define GPU_TIMER_FRAMES 4
+
+// GL_TIME_ELAPSED queries around one section of every frame, read back
+// GPU_TIMER_FRAMES frames later so the CPU does not wait on them. Each
+// result is traced on the timer's own track, starting where the CPU began
+// the section, since GPU timestamps are on a different clock.
+typedef struct GpuTimer {
+	const char *name;
+	TraceRing *track;
+	GLuint queries[GPU_TIMER_FRAMES];
+	u64 cpu_start_ns[GPU_TIMER_FRAMES];
+	bool pending[GPU_TIMER_FRAMES];
+	u32 frame;
+} GpuTimer;
+
+void init_gpu_timer(GpuTimer *timer, const char *name, const char *track_name) {
+	memset(timer, 0, sizeof(GpuTimer));
+	timer->name = name;
+	timer->track = new_trace_track(track_name);
+	glGenQueries(GPU_TIMER_FRAMES, timer->queries);
+}
+
+void begin_gpu_timer(GpuTimer *timer) {
+	u32 slot = timer->frame % GPU_TIMER_FRAMES;
+	if (timer->pending[slot]) {
+		GLuint64 elapsed_ns = 0;
+		glGetQueryObjectui64v(timer->queries[slot], GL_QUERY_RESULT, &elapsed_ns);
+		trace_push(timer->track, timer->name, timer->cpu_start_ns[slot], elapsed_ns);
+		timer->pending[slot] = false;
+	}
+	if (!trace_enabled) {
+		return;
+	}
+
+	timer->cpu_start_ns[slot] = get_time_ns();
+	glBeginQuery(GL_TIME_ELAPSED, timer->queries[slot]);
+	timer->pending[slot] = true;
+}
+
+void end_gpu_timer(GpuTimer *timer) {
+	if (timer->pending[timer->frame % GPU_TIMER_FRAMES]) {
+		glEndQuery(GL_TIME_ELAPSED);
+	}
+	timer->frame++;
+}
+
+void free_gpu_timer(GpuTimer *timer) {
+	glDeleteQueries(GPU_TIMER_FRAMES, timer->queries);
+}
+#else
+typedef struct GpuTimer {
+} GpuTimer;
+
+void init_gpu_timer(GpuTimer *timer, const char *name, const char *track_name) {
+}
+
+void begin_gpu_timer(GpuTimer *timer) {
+}
+
+void end_gpu_timer(GpuTimer *timer) {
+}
+
+void free_gpu_timer(GpuTimer *timer) {
+}
+#endif
+
 #endif
@@ -0,0 +1,429 @@
+// Headless render benchmark. Draws the streamed world along a scripted
+// camera path into an offscreen framebuffer, through a surfaceless EGL
+// context, so it needs neither a display nor a GPU: Mesa's llvmpipe will do.
+// Prints per-frame CPU and GPU times as JSON and writes the frames asked for
+// as TGA files, for comparing renders between builds.
+//
+// usage: voxel_headless [-f frames] [-r radius] [-s width,height] [-p path.txt] [-c frame[,frame...]] [-o dir] [-v dir] [-w world] [-i draw_path] [-x trace.json]
+//   frames is the length of the run, 300 by default
+//   radius is the view radius in chunks, as for voxel -r
+//   path.txt holds camera keyframes, one "frame x y z yaw pitch" per line,
+//      moved between linearly; without it the camera flies diagonally
+//      across the terrain while turning
+//   each captured frame is written to dir/frame_NNNN.tga; the stream is
+//      filled and every chunk uploaded before it is drawn, so captures do
+//      not depend on how fast chunks happened to load
+//   -v records every frame to dir/frame_NNNNNN.tga through the asynchronous
+//      capture, as for voxel -v, and reports what that cost the render thread
+//   -i caps the chunk draw path as for voxel -i
+//   -x writes a Chrome trace of the run
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "stb_perlin.h"
+
+#define HEADLESS 1
+
+#include "common.h"
+#include "chunk.h"
+#include "jobs.h"
+#include "streaming.h"
+#include "renderer.h"
+#include "capture.h"
+#include "tga.h"
+#include "timer.h"
+#include "trace.h"
+#include "gl_helper.h"
+
+// GPU times are read this many frames late, so the CPU does not wait on them
+#define HEADLESS_QUERY_FRAMES 4
+#define MAX_KEYFRAMES 256
+
+typedef struct Keyframe {
+	u32 frame;
+	glm::vec3 position;
+	f32 yaw;
+	f32 pitch;
+} Keyframe;
+
+typedef struct CameraPath {
+	Keyframe keys[MAX_KEYFRAMES];
+	u32 num_keys;
+} CameraPath;
+
+typedef struct FrameTimes {
+	u64 cpu_ns;
+	u64 gpu_ns;
+} FrameTimes;
+
+bool load_camera_path(const char *filename, CameraPath *path) {
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		return false;
+	}
+
+	path->num_keys = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), file) && path->num_keys < MAX_KEYFRAMES) {
+		Keyframe *key = &path->keys[path->num_keys];
+		if (line[0] == '#') {
+			continue;
+		}
+		if (sscanf(line, "%u %f %f %f %f %f", &key->frame, &key->position.x, &key->position.y, &key->position.z, &key->yaw, &key->pitch) == 6) {
+			// Kept in frame order
+			if (path->num_keys == 0 || key->frame > path->keys[path->num_keys - 1].frame) {
+				path->num_keys++;
+			}
+		}
+	}
+	fclose(file);
+	return path->num_keys > 0;
+}
+
+void default_camera_path(CameraPath *path, u32 frames) {
+	f32 distance = 1.5f * (f32)frames;
+	path->num_keys = 2;
+	path->keys[0].frame = 0;
+	path->keys[0].position = glm::vec3(8.0f, 180.0f, 8.0f);
+	path->keys[0].yaw = 45.0f;
+	path->keys[0].pitch = -25.0f;
+	path->keys[1].frame = frames > 1 ? frames - 1 : 1;
+	path->keys[1].position = glm::vec3(8.0f + distance * 0.707f, 180.0f, 8.0f + distance * 0.707f);
+	path->keys[1].yaw = 90.0f;
+	path->keys[1].pitch = -15.0f;
+}
+
+Keyframe camera_at(CameraPath *path, u32 frame) {
+	u32 k = 0;
+	while (k + 1 < path->num_keys && path->keys[k + 1].frame <= frame) {
+		k++;
+	}
+	if (k + 1 == path->num_keys || frame <= path->keys[k].frame) {
+		return path->keys[k];
+	}
+
+	Keyframe *a = &path->keys[k];
+	Keyframe *b = &path->keys[k + 1];
+	f32 t = (f32)(frame - a->frame) / (f32)(b->frame - a->frame);
+	Keyframe key;
+	key.frame = frame;
+	key.position = a->position + (b->position - a->position) * t;
+	key.yaw = a->yaw + (b->yaw - a->yaw) * t;
+	key.pitch = a->pitch + (b->pitch - a->pitch) * t;
+	return key;
+}
+
+glm::vec3 camera_front_from(f32 yaw, f32 pitch) {
+	return glm::vec3(cos(glm::radians(yaw)) * cos(glm::radians(pitch)), sin(glm::radians(pitch)), sin(glm::radians(yaw)) * cos(glm::radians(pitch)));
+}
+
+// A GL 3.3 core context like the window's, current with no surface at all
+bool create_headless_context() {
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display) {
+		display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (display == EGL_NO_DISPLAY) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+		fprintf(stderr, "could not initialize EGL\n");
+		return false;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "EGL has no desktop OpenGL\n");
+		return false;
+	}
+
+	// Nothing is drawn to an EGL surface, so a context without a config
+	// will do where there is none for OpenGL, as on the surfaceless platform
+	EGLint config_attribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+	EGLConfig config = (EGLConfig)0;
+	EGLint num_configs = 0;
+	if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs == 0) {
+		config = (EGLConfig)0;
+	}
+
+	EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_CONTEXT_OPENGL_DEBUG, RELEASE ? EGL_FALSE : EGL_TRUE,
+		EGL_NONE,
+	};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		fprintf(stderr, "could not make a surfaceless GL 3.3 core context current\n");
+		return false;
+	}
+	return true;
+}
+
+int compare_u64(const void *a, const void *b) {
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+	return (x > y) - (x < y);
+}
+
+void print_times(const char *name, FrameTimes *times, u32 count, bool gpu, bool last) {
+	u64 *values = (u64 *)malloc(sizeof(u64) * count);
+	for (u32 i = 0; i < count; i++) {
+		values[i] = gpu ? times[i].gpu_ns : times[i].cpu_ns;
+	}
+	qsort(values, count, sizeof(u64), compare_u64);
+	printf("  \"%s\": { \"min_ms\": %.3f, \"median_ms\": %.3f, \"p99_ms\": %.3f }%s\n", name,
+		   ns_to_ms(values[0]), ns_to_ms(values[count / 2]), ns_to_ms(values[(u32)(0.99 * (f64)(count - 1) + 0.5)]),
+		   last ? "" : ",");
+	free(values);
+}
+
+bool save_frame(const char *dir, u32 frame, i32 width, i32 height, u8 *pixels) {
+	char filename[1024];
+	snprintf(filename, sizeof(filename), "%s/frame_%04u.tga", dir, frame);
+
+	// Rows come bottom up, as TGA stores them
+	GL_CHECK(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+	GL_CHECK(glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, pixels));
+
+	Image img;
+	img.width = width;
+	img.height = height;
+	img.bytes_per_pixel = 3;
+	img.data = pixels;
+	return write_tga(filename, &img, false);
+}
+
+int main(int argc, char **argv) {
+	u32 frames = 300;
+	u32 view_radius = 6;
+	i32 width = 640;
+	i32 height = 480;
+	const char *path_file = NULL;
+	const char *capture_dir = ".";
+	const char *world_dir = "world";
+	const char *trace_path = NULL;
+	const char *record_dir = NULL;
+	DrawPath max_draw_path = DRAW_MULTI_INDIRECT;
+	u8 *capture = NULL;
+	char *capture_list = NULL;
+
+	for (i32 i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			frames = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			view_radius = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			if (sscanf(argv[++i], "%d,%d", &width, &height) != 2 || width <= 0 || height <= 0 || width > 65535 || height > 65535) {
+				fprintf(stderr, "bad size %s\n", argv[i]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			path_file = argv[++i];
+		} else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+			capture_list = argv[++i];
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			capture_dir = argv[++i];
+		} else if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+			record_dir = argv[++i];
+		} else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			world_dir = argv[++i];
+		} else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+			max_draw_path = (DrawPath)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-x") && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [-f frames] [-r radius] [-s width,height] [-p path.txt] [-c frame[,frame...]] [-o dir] [-v dir] [-w world] [-i draw_path] [-x trace.json]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (frames == 0) {
+		return 0;
+	}
+
+	capture = (u8 *)calloc(frames, 1);
+	if (capture_list) {
+		for (char *tok = strtok(capture_list, ","); tok; tok = strtok(NULL, ",")) {
+			u32 frame = (u32)atoi(tok);
+			if (frame < frames) {
+				capture[frame] = true;
+			}
+		}
+	}
+
+	CameraPath path;
+	if (path_file) {
+		if (!load_camera_path(path_file, &path)) {
+			fprintf(stderr, "no keyframes in %s\n", path_file);
+			return 1;
+		}
+	} else {
+		default_camera_path(&path, frames);
+	}
+
+	trace_name_thread("main");
+	if (trace_path) {
+		trace_start();
+	}
+
+	if (!create_headless_context()) {
+		return 1;
+	}
+	init_gl_debug();
+
+	GLuint fbo;
+	GLuint renderbuffers[2];
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenRenderbuffers(2, renderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "offscreen framebuffer incomplete\n");
+		return 1;
+	}
+
+	JobSystem *jobs = create_job_system(0);
+	Keyframe key = camera_at(&path, 0);
+	RegionStore *regions = create_region_store(world_dir);
+	ChunkStream *stream = create_chunk_stream(jobs, regions, view_radius);
+	fill_chunk_stream(stream, key.position);
+
+	Renderer renderer;
+	init_renderer(&renderer, width, height, max_draw_path);
+	FrameCapture *recorder = NULL;
+	if (record_dir) {
+		recorder = create_frame_capture(record_dir, width, height);
+	}
+
+	GLuint queries[HEADLESS_QUERY_FRAMES];
+	glGenQueries(HEADLESS_QUERY_FRAMES, queries);
+	// llvmpipe reports nonsense for the first timed query that draws
+	// anything, so one is thrown away
+	GLuint64 warm_up_ns;
+	glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glEndQuery(GL_TIME_ELAPSED);
+	glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &warm_up_ns);
+	FrameTimes *times = (FrameTimes *)calloc(frames, sizeof(FrameTimes));
+	u8 *pixels = (u8 *)malloc((u64)width * height * 3);
+	u32 captured = 0;
+	u32 failed = 0;
+	GlFrameStats gl_stats;
+	u64 gl_calls = 0;
+	u64 gl_errors = 0;
+	glm::vec3 camera_up = glm::vec3(0.0, 1.0, 0.0);
+
+	for (u32 f = 0; f < frames; f++) {
+		TRACE_SCOPE("frame");
+		u32 slot = f % HEADLESS_QUERY_FRAMES;
+		if (f >= HEADLESS_QUERY_FRAMES) {
+			GLuint64 elapsed_ns = 0;
+			glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsed_ns);
+			times[f - HEADLESS_QUERY_FRAMES].gpu_ns = elapsed_ns;
+		}
+
+		key = camera_at(&path, f);
+		glm::vec3 camera_front = camera_front_from(key.yaw, key.pitch);
+
+		u64 saved_budget = upload_budget_bytes;
+		if (capture[f]) {
+			fill_chunk_stream(stream, key.position);
+			upload_budget_bytes = ~0ul;
+		}
+
+		u64 start = get_time_ns();
+		StreamStats stream_stats;
+		memset(&stream_stats, 0, sizeof(stream_stats));
+		update_chunk_stream(stream, key.position, &stream_stats);
+
+		glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+		render_world(&renderer, stream, key.position, camera_front, camera_up);
+		glEndQuery(GL_TIME_ELAPSED);
+		if (recorder) {
+			capture_frame(recorder);
+		}
+		times[f].cpu_ns = get_time_ns() - start;
+		upload_budget_bytes = saved_budget;
+
+		if (capture[f]) {
+			if (save_frame(capture_dir, f, width, height, pixels)) {
+				captured++;
+			} else {
+				failed++;
+			}
+		}
+
+		gl_end_frame(&gl_stats);
+		gl_calls += gl_stats.calls;
+		gl_errors += gl_stats.errors;
+	}
+
+	for (u32 f = frames > HEADLESS_QUERY_FRAMES ? frames - HEADLESS_QUERY_FRAMES : 0; f < frames; f++) {
+		GLuint64 elapsed_ns = 0;
+		glGetQueryObjectui64v(queries[f % HEADLESS_QUERY_FRAMES], GL_QUERY_RESULT, &elapsed_ns);
+		times[f].gpu_ns = elapsed_ns;
+	}
+
+	CaptureStats record_stats;
+	memset(&record_stats, 0, sizeof(record_stats));
+	if (recorder) {
+		free_frame_capture(recorder, &record_stats);
+	}
+
+	printf("{\n  \"renderer\": \"%s\",\n  \"gl_version\": \"%s\",\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+	printf("  \"width\": %d,\n  \"height\": %d,\n  \"view_radius\": %u,\n  \"draw_path\": \"%s\",\n  \"streaming_ring\": \"%s\",\n",
+		   width, height, view_radius, draw_path_names[renderer.chunk_draws.path], renderer.ring.persistent ? "persistent" : "mapped per upload");
+	printf("  \"frames\": %u,\n  \"captured\": %u,\n  \"capture_failures\": %u,\n  \"gl_calls_per_frame\": %.1f,\n  \"gl_errors\": %lu,\n",
+		   frames, captured, failed, (f64)gl_calls / frames, gl_errors);
+	if (recorder) {
+		printf("  \"recorded\": { \"written\": %u, \"dropped\": %u, \"failures\": %u, \"stalls\": %u, \"render_thread_avg_ms\": %.3f, \"render_thread_max_ms\": %.3f, \"writer_avg_ms\": %.3f },\n",
+			   record_stats.frames_written, record_stats.frames_dropped, record_stats.write_failures, record_stats.stalls,
+			   ns_to_ms(record_stats.render_ns / frames), ns_to_ms(record_stats.render_max_ns),
+			   record_stats.frames_written ? ns_to_ms(record_stats.write_ns / record_stats.frames_written) : 0.0);
+	}
+	print_times("cpu", times, frames, false, false);
+	print_times("gpu", times, frames, true, false);
+	printf("  \"per_frame\": [\n");
+	for (u32 f = 0; f < frames; f++) {
+		printf("    { \"frame\": %u, \"cpu_ms\": %.3f, \"gpu_ms\": %.3f%s }%s\n", f, ns_to_ms(times[f].cpu_ns), ns_to_ms(times[f].gpu_ns),
+			   capture[f] ? ", \"captured\": true" : "", f + 1 < frames ? "," : "");
+	}
+	printf("  ]\n}\n");
+
+	glDeleteQueries(HEADLESS_QUERY_FRAMES, queries);
+	free(times);
+	free(pixels);
+	free(capture);
+	free_renderer(&renderer);
+	glDeleteRenderbuffers(2, renderbuffers);
+	glDeleteFramebuffers(1, &fbo);
+	free_chunk_stream(stream);
+	free_region_store(regions);
+
+	if (trace_path) {
+		trace_stop();
+		if (!write_chrome_trace(trace_path)) {
+			fprintf(stderr, "could not write trace to %s\n", trace_path);
+		}
+	}
+	destroy_job_system(jobs);
+
+	return gl_errors || failed || record_stats.write_failures ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#ifndef HEIGHTMAP_H
+#define HEIGHTMAP_H
+
+#include "common.h"
+#include "chunk.h"
+#include "tga.h"
+
+// Writes the height of every column of the loaded world as one greyscale
+// TGA, x to the right and z down, streaming each row straight out of the
+// real_blocks of the chunks it crosses. Gaps in the world are written as 0.
+// False when nothing is loaded, the world is too wide for a TGA or the file
+// could not be written.
+bool write_heightmap_tga(const char *filename, Chunk **chunks, bool rle) {
+	i32 min_cx = 0;
+	i32 min_cz = 0;
+	i32 max_cx = -1;
+	i32 max_cz = -1;
+	for (u32 i = 0; i < num_chunks; i++) {
+		Chunk *chunk = chunks[i];
+		if (!chunk) {
+			continue;
+		}
+		i32 cx = chunk->x_off / (i32)chunk_width;
+		i32 cz = chunk->z_off / (i32)chunk_depth;
+		if (max_cx < min_cx) {
+			min_cx = max_cx = cx;
+			min_cz = max_cz = cz;
+		}
+		min_cx = cx < min_cx ? cx : min_cx;
+		max_cx = cx > max_cx ? cx : max_cx;
+		min_cz = cz < min_cz ? cz : min_cz;
+		max_cz = cz > max_cz ? cz : max_cz;
+	}
+	if (max_cx < min_cx) {
+		return false;
+	}
+
+	u64 width = (u64)(max_cx - min_cx + 1) * chunk_width;
+	u64 height = (u64)(max_cz - min_cz + 1) * chunk_depth;
+	if (width > 0xffff || height > 0xffff) {
+		return false;
+	}
+
+	TgaWriter writer;
+	if (!open_tga_writer(&writer, filename, (u16)width, (u16)height, 1, rle, true)) {
+		return false;
+	}
+	u8 *empty_row = (u8 *)calloc(chunk_width, 1);
+	for (i32 cz = min_cz; cz <= max_cz; cz++) {
+		for (u32 z = 0; z < chunk_depth; z++) {
+			for (i32 cx = min_cx; cx <= max_cx; cx++) {
+				Chunk *chunk = find_chunk(chunks, cx, cz);
+				write_tga_pixels(&writer, chunk ? chunk->real_blocks + twod_to_oned(0, z, chunk_width) : empty_row, chunk_width);
+			}
+		}
+	}
+	free(empty_row);
+	return close_tga_writer(&writer);
+}
+
+#endif
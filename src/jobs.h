@@ -0,0 +1,217 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+#include "trace.h"
+
+// Work-stealing job system. Every worker owns a deque; it pushes and pops
+// its own jobs at the back and steals from the front of other workers'
+// deques when it runs dry. The thread that created the system is worker 0
+// and only runs jobs while inside wait_for_jobs.
+
+typedef void (*JobFunc)(void *data, u32 idx);
+
+typedef struct Job {
+	JobFunc func;
+	void *data;
+	u32 idx;
+} Job;
+
+typedef struct JobQueue {
+	std::mutex lock;
+	Job *jobs;
+	u32 head;
+	u32 count;
+	u32 capacity;
+} JobQueue;
+
+typedef struct JobSystem {
+	std::thread *threads;
+	JobQueue *queues;
+	u32 num_workers;
+
+	std::atomic<u32> pending;
+	std::atomic<u32> queued;
+	std::atomic<bool> running;
+
+	std::mutex sleep_lock;
+	std::condition_variable wake;
+} JobSystem;
+
+thread_local u32 job_worker_idx = 0;
+
+void queue_push(JobQueue *q, Job job) {
+	std::lock_guard<std::mutex> guard(q->lock);
+	if (q->count == q->capacity) {
+		u32 new_capacity = q->capacity ? q->capacity * 2 : 64;
+		Job *jobs = (Job *)malloc(sizeof(Job) * new_capacity);
+		for (u32 i = 0; i < q->count; i++) {
+			jobs[i] = q->jobs[(q->head + i) % q->capacity];
+		}
+		free(q->jobs);
+		q->jobs = jobs;
+		q->head = 0;
+		q->capacity = new_capacity;
+	}
+	q->jobs[(q->head + q->count) % q->capacity] = job;
+	q->count++;
+}
+
+bool queue_pop_back(JobQueue *q, Job *job) {
+	std::lock_guard<std::mutex> guard(q->lock);
+	if (q->count == 0) {
+		return false;
+	}
+	q->count--;
+	*job = q->jobs[(q->head + q->count) % q->capacity];
+	return true;
+}
+
+bool queue_steal_front(JobQueue *q, Job *job) {
+	std::lock_guard<std::mutex> guard(q->lock);
+	if (q->count == 0) {
+		return false;
+	}
+	*job = q->jobs[q->head];
+	q->head = (q->head + 1) % q->capacity;
+	q->count--;
+	return true;
+}
+
+bool take_job(JobSystem *sys, Job *job) {
+	u32 self = job_worker_idx;
+	if (queue_pop_back(&sys->queues[self], job)) {
+		sys->queued--;
+		return true;
+	}
+	for (u32 i = 1; i < sys->num_workers; i++) {
+		if (queue_steal_front(&sys->queues[(self + i) % sys->num_workers], job)) {
+			sys->queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void run_job(JobSystem *sys, Job job) {
+	job.func(job.data, job.idx);
+	sys->pending--;
+}
+
+// Pushes onto the given worker's deque, used to spread a batch of initial
+// jobs over every worker
+void push_job_to(JobSystem *sys, u32 worker, JobFunc func, void *data, u32 idx) {
+	Job job;
+	job.func = func;
+	job.data = data;
+	job.idx = idx;
+
+	sys->pending++;
+	queue_push(&sys->queues[worker % sys->num_workers], job);
+	sys->queued++;
+
+	{
+		std::lock_guard<std::mutex> guard(sys->sleep_lock);
+	}
+	sys->wake.notify_one();
+}
+
+// Pushes onto the calling worker's own deque, or worker 0's when called
+// from a thread outside the system
+void push_job(JobSystem *sys, JobFunc func, void *data, u32 idx) {
+	push_job_to(sys, job_worker_idx, func, data, idx);
+}
+
+void worker_loop(JobSystem *sys, u32 idx) {
+	job_worker_idx = idx;
+	char name[32];
+	snprintf(name, sizeof(name), "worker %u", idx);
+	trace_name_thread(name);
+
+	while (sys->running) {
+		Job job;
+		if (take_job(sys, &job)) {
+			run_job(sys, job);
+		} else {
+			std::unique_lock<std::mutex> lock(sys->sleep_lock);
+			sys->wake.wait(lock, [sys] { return sys->queued > 0 || !sys->running; });
+		}
+	}
+}
+
+// Runs jobs on the calling thread until every pushed job has finished
+void wait_for_jobs(JobSystem *sys) {
+	while (sys->pending > 0) {
+		Job job;
+		if (take_job(sys, &job)) {
+			run_job(sys, job);
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+// Runs one queued job on the calling thread if there is one, without
+// waiting for anything else. Lets a frame loop make progress on background
+// work when the system has no other workers.
+bool try_run_job(JobSystem *sys) {
+	Job job;
+	if (take_job(sys, &job)) {
+		run_job(sys, job);
+		return true;
+	}
+	return false;
+}
+
+// num_workers of 0 uses one worker per hardware thread
+JobSystem *create_job_system(u32 num_workers) {
+	if (num_workers == 0) {
+		num_workers = std::thread::hardware_concurrency();
+		if (num_workers == 0) {
+			num_workers = 1;
+		}
+	}
+
+	JobSystem *sys = new JobSystem();
+	sys->num_workers = num_workers;
+	sys->queues = new JobQueue[num_workers]();
+	sys->pending = 0;
+	sys->queued = 0;
+	sys->running = true;
+
+	job_worker_idx = 0;
+	sys->threads = new std::thread[num_workers];
+	for (u32 i = 1; i < num_workers; i++) {
+		sys->threads[i] = std::thread(worker_loop, sys, i);
+	}
+
+	return sys;
+}
+
+void destroy_job_system(JobSystem *sys) {
+	{
+		std::lock_guard<std::mutex> guard(sys->sleep_lock);
+		sys->running = false;
+	}
+	sys->wake.notify_all();
+
+	for (u32 i = 1; i < sys->num_workers; i++) {
+		sys->threads[i].join();
+	}
+
+	for (u32 i = 0; i < sys->num_workers; i++) {
+		free(sys->queues[i].jobs);
+	}
+	delete[] sys->queues;
+	delete[] sys->threads;
+	delete sys;
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "point.h"
+#include "chunk.h"
+#include "mesher.h"
+#include "culling.h"
+
+// Distance level of detail. Level n meshes a chunk from its heightmap
+// downsampled to (1 << n) x (1 << n) columns, each the tallest column it
+// covers, so distant terrain keeps its silhouette with a quarter of the
+// triangles per level. Every level starts at twice the distance of the one
+// before, which keeps the triangle count of each ring of chunks about the
+// same as the view radius grows.
+//
+// Coarse columns never sit below the real terrain, so cracks against a
+// neighbouring chunk of any level can only open above the lowest real column
+// along the shared edge. Chunk borders therefore get skirts reaching down to
+// that height, mirroring the side faces a full resolution chunk shows.
+
+#define MAX_LOD 3
+
+f32 lod_distance = 64.0f;
+f32 lod_hysteresis = 0.1f;
+
+u32 lod_for_distance(f32 dist) {
+	u32 level = 0;
+	while (level < MAX_LOD && dist >= lod_distance * (f32)(1 << level)) {
+		level++;
+	}
+	return level;
+}
+
+// A chunk only changes level once it is a margin past the boundary, so one
+// sitting on it does not flip every frame
+u32 select_lod(u32 current, f32 dist) {
+	u32 coarser = lod_for_distance(dist / (1.0f + lod_hysteresis));
+	if (coarser > current) {
+		return coarser;
+	}
+
+	u32 finer = lod_for_distance(dist * (1.0f + lod_hysteresis));
+	if (finer < current) {
+		return finer;
+	}
+
+	return current;
+}
+
+// Levels follow the horizontal distance from the camera to each chunk's
+// centre, returns the number of chunks that changed level
+u32 update_chunk_lods(ChunkBounds *bounds, glm::vec3 camera, u8 *levels) {
+	u32 changed = 0;
+	for (u32 i = 0; i < bounds->count; i++) {
+		f32 dx = bounds->center_x[i] - camera.x;
+		f32 dz = bounds->center_z[i] - camera.z;
+		u32 level = select_lod(levels[i], sqrtf(dx * dx + dz * dz));
+
+		changed += level != levels[i];
+		levels[i] = level;
+	}
+	return changed;
+}
+
+// Rebuilds mesh for the chunk at the given level, which must be above 0;
+// level 0 is the regular full resolution path
+void mesh_chunk_lod(Chunk **chunks, u32 chunk_idx, u32 level, ChunkMesh *mesh) {
+	TRACE_SCOPE("mesh_chunk_lod");
+	Chunk *chunk = chunks[chunk_idx];
+	mesh->num_vertices = 0;
+	mesh->num_indices = 0;
+
+	i32 step = 1 << level;
+	i32 cols_x = chunk_width / step;
+	i32 cols_z = chunk_depth / step;
+
+	// Coarse heights with the tile of the tallest column they cover
+	i32 *heights = (i32 *)malloc(sizeof(i32) * cols_x * cols_z);
+	u8 *tiles = (u8 *)malloc(cols_x * cols_z);
+	for (i32 cz = 0; cz < cols_z; cz++) {
+		for (i32 cx = 0; cx < cols_x; cx++) {
+			i32 top = -1;
+			u8 tile_id = 0;
+			for (i32 z = cz * step; z < (cz + 1) * step; z++) {
+				for (i32 x = cx * step; x < (cx + 1) * step; x++) {
+					i32 h = chunk->real_blocks[twod_to_oned(x, z, chunk_width)];
+					if (h > top) {
+						top = h;
+						tile_id = chunk->pre_render_list[threed_to_oned(x, h, z, chunk_width, chunk_height)];
+					}
+				}
+			}
+			heights[cz * cols_x + cx] = top;
+			tiles[cz * cols_x + cx] = tile_id;
+		}
+	}
+
+	Face sides[4] = {FACE_FRONT, FACE_BACK, FACE_LEFT, FACE_RIGHT};
+
+	for (i32 cz = 0; cz < cols_z; cz++) {
+		for (i32 cx = 0; cx < cols_x; cx++) {
+			i32 h = heights[cz * cols_x + cx];
+			glm::vec3 color = tile_palette[tiles[cz * cols_x + cx]];
+			glm::vec3 origin = glm::vec3(chunk->x_off + cx * step, 0, chunk->z_off + cz * step);
+
+			mesh_push_quad(mesh, FACE_TOP, origin, glm::vec3(step, h + 1, step), color, AO_LIT);
+
+			for (u32 s = 0; s < 4; s++) {
+				i32 *n = face_normals[sides[s]];
+				i32 nx = cx + n[0];
+				i32 nz = cz + n[2];
+
+				i32 bottom;
+				if (nx >= 0 && nz >= 0 && nx < cols_x && nz < cols_z) {
+					bottom = heights[nz * cols_x + nx];
+				} else {
+					// Skirt down to the lowest real column on either side of
+					// this stretch of the border
+					bottom = h;
+					for (i32 k = 0; k < step; k++) {
+						i32 x = n[0] ? (n[0] > 0 ? cols_x * step - 1 : 0) : cx * step + k;
+						i32 z = n[2] ? (n[2] > 0 ? cols_z * step - 1 : 0) : cz * step + k;
+						i32 inside = chunk->real_blocks[twod_to_oned(x, z, chunk_width)];
+						i32 outside = column_height(chunks, chunk_idx, x + n[0], z + n[2]);
+						bottom = inside < bottom ? inside : bottom;
+						bottom = outside < bottom ? outside : bottom;
+					}
+				}
+
+				if (bottom < h) {
+					glm::vec3 wall_origin = origin + glm::vec3(0, bottom + 1, 0);
+					mesh_push_quad(mesh, sides[s], wall_origin, glm::vec3(step, h - bottom, step), color, AO_LIT);
+				}
+			}
+		}
+	}
+
+	free(heights);
+	free(tiles);
+}
+
+#endif
@@ -6,6 +6,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <time.h>
 
 #define STB_PERLIN_IMPLEMENTATION
@@ -13,75 +15,17 @@
 
 #include "common.h"
 #include "point.h"
-#include "cube.h"
+#include "chunk.h"
+#include "jobs.h"
+#include "streaming.h"
+#include "raycast.h"
+#include "renderer.h"
+#include "capture.h"
 #include "tga.h"
+#include "heightmap.h"
+#include "trace.h"
 #include "gl_helper.h"
 
-u32 chunk_width = 16;
-u32 chunk_height = 256;
-u32 chunk_depth = 16;
-u32 chunk_size = chunk_width * chunk_height * chunk_depth;
-
-u32 num_x_chunks = 9;
-u32 num_y_chunks = 9;
-u32 num_chunks = num_x_chunks * num_y_chunks;
-
-typedef struct Chunk {
-	u8 *pre_render_list;
-	u8 *real_blocks;
-
-	u32 *mappings;
-	glm::vec3 *positions;
-	glm::vec3 *colors;
-	u8 *ao_bits;
-
-	u64 num_blocks;
-	u32 x_off;
-	u32 z_off;
-} Chunk;
-
-Chunk *generate_chunk(u32 x_off, u32 z_off) {
-	Chunk *chunk = (Chunk *)malloc(sizeof(Chunk));
-
-	chunk->positions = (glm::vec3 *)malloc(sizeof(glm::vec3) * chunk_size);
-	chunk->colors = (glm::vec3 *)malloc(sizeof(glm::vec3) * chunk_size);
-	chunk->mappings = (u32 *)malloc(sizeof(u32) * chunk_size);
-	chunk->pre_render_list = (u8 *)malloc(chunk_size);
-	chunk->x_off = x_off * chunk_width;
-	chunk->z_off = z_off * chunk_depth;
-
-	u8 *height_map = (u8 *)malloc(chunk_width * chunk_depth);
-	memset(height_map, 0, sizeof(chunk_width * chunk_depth));
-
-	f32 min_height = chunk_height / 5;
-	f32 avg_height = chunk_height / 2;
-	for (u32 x = 0; x < chunk_width; x++) {
-		for (u32 z = 0; z < chunk_depth; z++) {
-
-			f32 column_height = avg_height;
-			for (u8 o = 5; o < 8; o++) {
-				f32 scale = (f32)(2 << o) * 1.01f;
-				column_height += (f32)(o << 4) * stb_perlin_noise3((f32)(x + chunk->x_off) / scale, (f32)(z + chunk->z_off) / scale, o * 2.0f, 256, 256, 256);
-			}
-
-			if (column_height > chunk_height) {
-				column_height = chunk_height;
-			}
-
-			if (column_height < min_height) {
-				column_height = min_height;
-			}
-
-			height_map[twod_to_oned(x, z, chunk_width)] = column_height;
-		}
-	}
-
-
-	chunk->real_blocks = height_map;
-	return chunk;
-}
-
-
 glm::vec3 random_color() {
 	f32 r = ((f32)(rand() % 10)) / 10;
 	f32 g = ((f32)(rand() % 10)) / 10;
@@ -91,154 +35,49 @@ glm::vec3 random_color() {
 	return color;
 }
 
-bool inside_chunk(u32 x, u32 y, u32 z) {
-	if (x < chunk_width && y < chunk_height && z < chunk_depth) {
-		return true;
-	}
-
-	return false;
-}
-
-void hull_chunk(Chunk **chunks, u32 chunk_idx) {
-	Chunk *chunk = chunks[chunk_idx];
-	memset(chunk->pre_render_list, 0, chunk_size);
-
-	for (u64 i = 0; i < chunk_width * chunk_depth; i++) {
-		Point p = oned_to_twod(i, chunk_width);
-
-		if (p.x > 0 && p.x < (chunk_width - 1) && p.y > 0 && p.y < (chunk_depth - 1)) {
-			//B
-			if (chunk->real_blocks[i] + 1 < chunk->real_blocks[twod_to_oned(p.x - 1, p.y, chunk_width)]) {
-				for (u32 dy = chunk->real_blocks[i] + 1; dy < chunk->real_blocks[twod_to_oned(p.x - 1, p.y, chunk_width)]; dy++) {
-					chunk->pre_render_list[threed_to_oned(p.x - 1, dy, p.y, chunk_width, chunk_height)] = 3;
-				}
-			}
-			//GB
-			if (chunk->real_blocks[i] + 1 < chunk->real_blocks[twod_to_oned(p.x + 1, p.y, chunk_width)]) {
-				//printf("(%d, %d, %d) | %d < (%d, %d, %d) | %d { delta: %d}\n", p.x, p.y, p.z, chunk->real_blocks[i], p.x+1, p.y, p.z, chunk->real_blocks[twod_to_oned(p.x + 1, p.y, chunk_width)], chunk->real_blocks[twod_to_oned(p.x + 1, p.y, chunk_width)] - chunk->real_blocks[i]);
-				for (u32 dy = chunk->real_blocks[i] + 1; dy < chunk->real_blocks[twod_to_oned(p.x + 1, p.y, chunk_width)]; dy++) {
-					chunk->pre_render_list[threed_to_oned(p.x + 1, dy, p.y, chunk_width, chunk_height)] = 2;
-				}
-			}
-			//RB
-			if (chunk->real_blocks[i] + 1 < chunk->real_blocks[twod_to_oned(p.x, p.y + 1, chunk_width)]) {
-				for (u32 dy = chunk->real_blocks[i] + 1; dy < chunk->real_blocks[twod_to_oned(p.x, p.y + 1, chunk_width)]; dy++) {
-					chunk->pre_render_list[threed_to_oned(p.x, dy, p.y + 1, chunk_width, chunk_height)] = 4;
-				}
-			}
-			//R
-			if (chunk->real_blocks[i] + 1 < chunk->real_blocks[twod_to_oned(p.x, p.y - 1, chunk_width)]) {
-				for (u32 dy = chunk->real_blocks[i] + 1; dy < chunk->real_blocks[twod_to_oned(p.x, p.y - 1, chunk_width)]; dy++) {
-					chunk->pre_render_list[threed_to_oned(p.x, dy, p.y - 1, chunk_width, chunk_height)] = 5;
-				}
-			}
-		} else {
-			Point cp = oned_to_twod(chunk_idx, num_x_chunks);
-			if (p.x == chunk_width - 1 && cp.x < (num_x_chunks - 1)) {
-				Chunk *other_chunk = chunks[threed_to_oned(cp.x + 1, cp.y, cp.z, num_x_chunks, num_y_chunks)];
-				if (chunk->real_blocks[i] > other_chunk->real_blocks[twod_to_oned(0, p.y, chunk_width)] + 1) {
-					for (u32 dy = chunk->real_blocks[i]; dy > other_chunk->real_blocks[twod_to_oned(0, p.y, chunk_width)]; dy--) {
-						chunk->pre_render_list[threed_to_oned(p.x, dy, p.y, chunk_width, chunk_height)] = 6;
-					}
-				}
-			}
-			if (p.x == 0 && cp.x > 0) {
-				Chunk *other_chunk = chunks[threed_to_oned(cp.x - 1, cp.y, cp.z, num_x_chunks, num_y_chunks)];
-				if (chunk->real_blocks[i] > other_chunk->real_blocks[twod_to_oned(chunk_width - 1, p.y, chunk_width)] + 1) {
-					for (u32 dy = chunk->real_blocks[i]; dy > other_chunk->real_blocks[twod_to_oned(chunk_width - 1, p.y, chunk_width)]; dy--) {
-						chunk->pre_render_list[threed_to_oned(p.x, dy, p.y, chunk_width, chunk_height)] = 7;
-					}
-				}
-			}
-			if (p.y == chunk_width - 1 && cp.y < (num_y_chunks - 1)) {
-				Chunk *other_chunk = chunks[threed_to_oned(cp.x, cp.y + 1, cp.z, num_x_chunks, num_y_chunks)];
-				if (chunk->real_blocks[i] > other_chunk->real_blocks[twod_to_oned(p.x, 0, chunk_width)] + 1) {
-					for (u32 dy = chunk->real_blocks[i]; dy > other_chunk->real_blocks[twod_to_oned(p.x, 0, chunk_width)]; dy--) {
-						chunk->pre_render_list[threed_to_oned(p.x, dy, p.y, chunk_width, chunk_height)] = 8;
-					}
-				}
-			}
-			if (p.y == 0 && cp.y > 0) {
-				Chunk *other_chunk = chunks[threed_to_oned(cp.x, cp.y - 1, cp.z, num_x_chunks, num_y_chunks)];
-				if (chunk->real_blocks[i] > other_chunk->real_blocks[twod_to_oned(p.x, chunk_depth - 1, chunk_width)] + 1) {
-					for (u32 dy = chunk->real_blocks[i]; dy > other_chunk->real_blocks[twod_to_oned(p.x, chunk_depth - 1, chunk_width)]; dy--) {
-						chunk->pre_render_list[threed_to_oned(p.x, dy, p.y, chunk_width, chunk_height)] = 9;
-					}
-				}
-			}
-
+int main(int argc, char **argv) {
+	// Chunks loaded in every direction around the camera
+	u32 view_radius = 6;
+	// Region files are read from and saved to here
+	const char *world_dir = "world";
+	// When set, a Chrome trace of the run is written here on exit
+	const char *trace_path = NULL;
+	// Also traces the GPU time of the draw section with timer queries
+	bool gpu_timing = false;
+	// Best way of drawing the instanced chunks to use, see DrawPath
+	DrawPath max_draw_path = DRAW_MULTI_INDIRECT;
+	// When set, every frame is recorded to this directory
+	const char *record_dir = NULL;
+	for (i32 i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			view_radius = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			world_dir = argv[++i];
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else if (!strcmp(argv[i], "-g")) {
+			gpu_timing = true;
+		} else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+			max_draw_path = (DrawPath)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+			record_dir = argv[++i];
 		}
-
-		chunk->pre_render_list[threed_to_oned(p.x, chunk->real_blocks[i], p.y, chunk_width, chunk_height)] = 1;
 	}
-}
-
-void update_chunk(Chunk **chunks, u32 chunk_idx) {
-	Chunk *chunk = chunks[chunk_idx];
-
-	u32 tile_index = 0;
-	for (u64 i = 0; i < chunk_size; i++) {
-		u32 tile_id = chunk->pre_render_list[i];
-		if (tile_id != 0) {
-			Point p = oned_to_threed(i, chunk_width, chunk_height);
-
-			switch (chunk->pre_render_list[i]) {
-				case 1: {
-					//green
-					chunk->colors[tile_index] = glm::vec3(0.0, 0.3, 0.0);
-				} break;
-				case 2: {
-					//blue
-					chunk->colors[tile_index] = glm::vec3(0.0, 0.0, 1.0);
-				} break;
-				case 3: {
-					//GB
-					chunk->colors[tile_index] = glm::vec3(1.0, 0.645, 0.0);
-				} break;
-				case 4: {
-					//RB
-					chunk->colors[tile_index] = glm::vec3(1.0, 0.0, 1.0);
-				} break;
-				case 5: {
-					//red
-					chunk->colors[tile_index] = glm::vec3(1.0, 0.0, 0.0);
-				} break;
-				case 6: {
-					//red
-					chunk->colors[tile_index] = glm::vec3(0.5, 1.0, 0.8);
-				} break;
-				case 7: {
-					//gray
-					chunk->colors[tile_index] = glm::vec3(0.255, 0.412, 0.88);
-				} break;
-				case 8: {
-					//white
-					chunk->colors[tile_index] = glm::vec3(1.0, 1.0, 1.0);
-				} break;
-				case 9: {
-					//magenta
-					chunk->colors[tile_index] = glm::vec3(0.9, 0.2, 0.5);
-				} break;
-			}
 
-			glm::vec3 m = glm::vec3(p.x + chunk->x_off, p.y, p.z + chunk->z_off);
-			chunk->positions[tile_index] = m;
-			chunk->mappings[i] = tile_index;
-
-			tile_index++;
-		}
+	trace_name_thread("main");
+	if (trace_path) {
+		trace_start();
 	}
 
-	chunk->num_blocks = tile_index;
-}
-
-int main() {
 	SDL_Init(SDL_INIT_VIDEO);
 
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+#if !RELEASE
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+#endif
 
 	i32 screen_width = 640;
 	i32 screen_height = 480;
@@ -250,96 +89,92 @@ int main() {
 
 	printf("GL version: %s\n", glGetString(GL_VERSION));
 	printf("GLSL version: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
+	if (init_gl_debug()) {
+		printf("GL errors: reported by debug output\n");
+	}
 	srand(time(NULL));
 
-	GLuint obj_shader_program = load_and_build_program("src/obj_vert.vsh", "src/obj_frag.fsh");
-
-	GLuint vao = 0;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	GLuint vbo_cube_points;
-	glGenBuffers(1, &vbo_cube_points);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_cube_points);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_points), cube_points, GL_STATIC_DRAW);
-
-	GLuint ibo_cube_indices;
-	glGenBuffers(1, &ibo_cube_indices);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_cube_indices);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_indices), cube_indices, GL_STATIC_DRAW);
-
-	GLuint points_attr = glGetAttribLocation(obj_shader_program, "coords");
-	GLuint tile_color_attr = glGetAttribLocation(obj_shader_program, "color");
-	GLuint model_attr = glGetAttribLocation(obj_shader_program, "model");
-
-	GLuint vbo_rect_points;
-	glGenBuffers(1, &vbo_rect_points);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_rect_points);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(rect_points), rect_points, GL_STATIC_DRAW);
-
-	GLuint ibo_rect_indices;
-	glGenBuffers(1, &ibo_rect_indices);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_rect_indices);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(rect_indices), rect_indices, GL_STATIC_DRAW);
-
-	GLuint pv_uniform = glGetUniformLocation(obj_shader_program, "pv");
-
-	glViewport(0, 0, screen_width, screen_height);
+	GpuTimer draw_timer;
+	if (gpu_timing) {
+		init_gpu_timer(&draw_timer, "draw", "gpu");
+	}
 
 	u32 start_time = SDL_GetTicks();
 
-	Chunk **chunks = (Chunk **)malloc(sizeof(Chunk *) * num_chunks);
-	for (u32 x = 0; x < num_x_chunks; x++) {
-		for (u32 y = 0; y < num_y_chunks; y++) {
-			Chunk *chunk = generate_chunk(x, y);
-			chunks[twod_to_oned(x, y, num_x_chunks)] = chunk;
-		}
-	}
+	JobSystem *jobs = create_job_system(0);
 
-	Image img;
-	img.width = chunk_width;
-	img.height = chunk_depth;
-	img.data = chunks[0]->real_blocks;
-	write_tga_bitmap("test.tga", &img);
+	// The world streams in around the camera as it moves; the first view is
+	// loaded before the window shows anything
+	glm::vec3 camera_pos = glm::vec3(chunk_width / 2, chunk_height + 3.0, chunk_depth / 2);
+	RegionStore *regions = create_region_store(world_dir);
+	ChunkStream *stream = create_chunk_stream(jobs, regions, view_radius);
+	fill_chunk_stream(stream, camera_pos);
+	Chunk **chunks = stream->chunks;
 
 	u32 block_load = 0;
 	for (u32 i = 0; i < num_chunks; i++) {
-		hull_chunk(chunks, i);
-		update_chunk(chunks, i);
-		block_load += chunks[i]->num_blocks;
+		if (chunks[i]) {
+			block_load += chunks[i]->num_blocks;
+		}
+	}
+
+	if (!write_heightmap_tga("heightmap.tga", chunks, true)) {
+		printf("could not write heightmap.tga\n");
 	}
 
 	u32 end_time = SDL_GetTicks();
-	printf("%u blocks in %u ms, %f bps\n", block_load, end_time - start_time, (f64)block_load / (f64)((end_time - start_time) / 1000.0f));
+	printf("%u blocks in %u ms, %f bps (%u workers, %u chunks read from %s)\n", block_load, end_time - start_time, (f64)block_load / (f64)((end_time - start_time) / 1000.0f), jobs->num_workers, regions->chunks_read, world_dir);
+
+	u64 world_bytes = world_memory_usage(chunks);
+	printf("chunk memory: %lu KB total, %lu KB per chunk\n", world_bytes / 1024, world_bytes / 1024 / num_chunks);
 
-	Point hovered = new_point(0, 0, 0);
+	// Block under the crosshair in world coordinates and the face looked at
+	f32 reach_distance = 64.0f;
+	bool hovering = false;
+	glm::ivec3 hovered = glm::ivec3(0, 0, 0);
+	Face hovered_face = FACE_TOP;
 
-	GLuint vbo_model;
-	glGenBuffers(1, &vbo_model);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_model);
+	Renderer renderer;
+	init_renderer(&renderer, screen_width, screen_height, max_draw_path);
+	if (gpu_timing) {
+		renderer.draw_timer = &draw_timer;
+	}
+	printf("streaming ring: %s\n", renderer.ring.persistent ? "persistently mapped" : "mapped per upload");
+	printf("chunk draws: %s\n", draw_path_names[renderer.chunk_draws.path]);
+
+	FrameCapture *capture = NULL;
+	if (record_dir) {
+		capture = create_frame_capture(record_dir, screen_width, screen_height);
+		printf("recording frames to %s\n", record_dir);
+	}
 
-	GLuint vbo_tile_color;
-	glGenBuffers(1, &vbo_tile_color);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_tile_color);
+	StreamStats stream_stats;
+	StreamStats stream_totals;
+	memset(&stream_totals, 0, sizeof(stream_totals));
+	UploadStats upload_totals;
+	memset(&upload_totals, 0, sizeof(upload_totals));
+	GlFrameStats gl_stats;
+	GlFrameStats gl_totals;
+	memset(&gl_totals, 0, sizeof(gl_totals));
+	u32 stats_frames = 0;
+	u32 stats_time = SDL_GetTicks();
 
 	f32 current_time = (f32)SDL_GetTicks() / 60.0;
 	f32 t = 0.0;
 
-	glm::vec3 camera_pos = glm::vec3(chunk_width / 2, chunk_height + 3.0, chunk_depth / 2);
 	glm::vec3 camera_front = glm::vec3(0.0, 0.0, 1.0);
 	glm::vec3 camera_up = glm::vec3(0.0, 1.0, 0.0);
 
 	f32 yaw = 0.0f;
 	f32 pitch = 0.0f;
 
-	glEnable(GL_CULL_FACE);
-
 	u8 warped = false;
 	u8 warp = false;
 	bool clicked = false;
 
 	u8 running = true;
 	while (running) {
+		TRACE_SCOPE("frame");
 		SDL_Event event;
 
 		f32 new_time = (f32)SDL_GetTicks() / 60.0;
@@ -372,6 +207,10 @@ int main() {
 							warp = false;
 							SDL_SetRelativeMouseMode(SDL_FALSE);
 						} break;
+						case SDLK_m: {
+							renderer.render_mode = renderer.render_mode == RENDER_INSTANCED ? RENDER_GREEDY_MESH : RENDER_INSTANCED;
+							printf("render mode: %s\n", renderer.render_mode == RENDER_INSTANCED ? "instanced cubes" : "greedy mesh");
+						} break;
 					}
 				} break;
 				case SDL_MOUSEMOTION: {
@@ -415,8 +254,11 @@ int main() {
 					SDL_SetRelativeMouseMode(SDL_TRUE);
 					warp = true;
 
-					if (buttons & SDL_BUTTON(SDL_BUTTON_LEFT)) {
-					} else if (buttons & SDL_BUTTON(SDL_BUTTON_RIGHT)) {
+					if (hovering && (buttons & SDL_BUTTON(SDL_BUTTON_LEFT))) {
+						edit_stream_block(stream, hovered.x, hovered.y, hovered.z, false);
+					} else if (hovering && (buttons & SDL_BUTTON(SDL_BUTTON_RIGHT))) {
+						i32 *n = face_normals[hovered_face];
+						edit_stream_block(stream, hovered.x + n[0], hovered.y + n[1], hovered.z + n[2], true);
 					}
 				} break;
 				case SDL_QUIT: {
@@ -425,66 +267,92 @@ int main() {
 			}
 		}
 
-		glEnable(GL_DEPTH_TEST);
-		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-		glUseProgram(obj_shader_program);
-
-		glEnableVertexAttribArray(points_attr);
-		glEnableVertexAttribArray(tile_color_attr);
-		glEnableVertexAttribArray(model_attr);
-
-		i32 size;
-
-		GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vbo_cube_points));
-		GL_CHECK(glVertexAttribPointer(points_attr, 3, GL_FLOAT, GL_FALSE, 0, 0));
+		memset(&stream_stats, 0, sizeof(stream_stats));
+		update_chunk_stream(stream, camera_pos, &stream_stats);
 
-		GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_cube_indices));
-		GL_CHECK(glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size));
+		RayHit hover = raycast(chunks, camera_pos, camera_front, reach_distance);
+		hovering = hover.hit;
+		hovered = hover.block;
+		hovered_face = hover.face;
 
-		GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vbo_tile_color));
-		GL_CHECK(glVertexAttribPointer(tile_color_attr, 3, GL_FLOAT, GL_FALSE, 0, 0));
-		GL_CHECK(glVertexAttribDivisor(tile_color_attr, 1));
-
-		GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vbo_model));
-		GL_CHECK(glVertexAttribPointer(model_attr, 3, GL_FLOAT, GL_FALSE, 0, 0));
-		GL_CHECK(glVertexAttribDivisor(model_attr, 1));
-
-		glm::mat4 perspective;
-		perspective = glm::perspective(glm::radians(45.0f), (f32)screen_width / (f32)screen_height, 0.1f, 5000.0f);
-		glm::mat4 view;
-		view = glm::lookAt(camera_pos, camera_pos + camera_front, camera_up);
-		glm::mat4 pv = perspective * view;
-		glUniformMatrix4fv(pv_uniform, 1, GL_FALSE, &pv[0][0]);
-
-		for (u32 i = 0; i < num_chunks; i++) {
-			glBindBuffer(GL_ARRAY_BUFFER, vbo_tile_color);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * chunks[i]->num_blocks, chunks[i]->colors, GL_STREAM_DRAW);
-
-			glBindBuffer(GL_ARRAY_BUFFER, vbo_model);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * chunks[i]->num_blocks, chunks[i]->positions, GL_STREAM_DRAW);
-
-			GL_CHECK(glDrawElementsInstanced(GL_TRIANGLES, size / sizeof(GLushort), GL_UNSIGNED_SHORT, 0, chunks[i]->num_blocks));
+		render_world(&renderer, stream, camera_pos, camera_front, camera_up);
+		if (capture) {
+			capture_frame(capture);
 		}
 
-		glDisable(GL_DEPTH_TEST);
-
-        chunks[0]->colors[0] = glm::vec3(1.0, 1.0, 1.0);
-		pv = glm::ortho(-66.5f, 66.5f, -37.6f, 37.6f, -1.0f, 1.0f);
-
-		chunks[0]->positions[0] = glm::vec3(0.1, 0.0, 0.0);
-
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_tile_color);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3), chunks[0]->colors, GL_STREAM_DRAW);
-
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_model);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3), chunks[0]->positions, GL_STREAM_DRAW);
+		gl_end_frame(&gl_stats);
+		gl_totals.calls += gl_stats.calls;
+		gl_totals.errors += gl_stats.errors;
+
+		upload_totals.bytes_uploaded += renderer.upload_stats.bytes_uploaded;
+		upload_totals.buffers_reallocated += renderer.upload_stats.buffers_reallocated;
+		upload_totals.chunks_uploaded += renderer.upload_stats.chunks_uploaded;
+		stream_totals.loaded += stream_stats.loaded;
+		stream_totals.unloaded += stream_stats.unloaded;
+		stream_totals.read += stream_stats.read;
+		stream_totals.reused += stream_stats.reused;
+		stream_totals.evicted += stream_stats.evicted;
+		stream_totals.latency_total_ns += stream_stats.latency_total_ns;
+		if (stream_stats.latency_max_ns > stream_totals.latency_max_ns) {
+			stream_totals.latency_max_ns = stream_stats.latency_max_ns;
+		}
+		stats_frames++;
+		if (SDL_GetTicks() - stats_time >= 1000) {
+			printf("%u frames: %lu bytes uploaded, %u buffers reallocated, %u chunks uploaded, %u pending, %u chunks drawn, %u culled, %u occluded\n",
+				   stats_frames, upload_totals.bytes_uploaded, upload_totals.buffers_reallocated,
+				   upload_totals.chunks_uploaded, renderer.upload_stats.chunks_pending, renderer.cull_stats.drawn, renderer.cull_stats.culled, renderer.cull_stats.occluded);
+			printf("    %u chunks loaded (%u from disk), %u unloaded, %u reused, %u evicted, %u jobs in flight, latency %.1f ms avg %.1f ms max\n",
+				   stream_totals.loaded, stream_totals.read, stream_totals.unloaded, stream_totals.reused, stream_totals.evicted, stream_stats.in_flight,
+				   stream_totals.loaded ? ns_to_ms(stream_totals.latency_total_ns / stream_totals.loaded) : 0.0,
+				   ns_to_ms(stream_totals.latency_max_ns));
+			printf("    %.2f ms per frame, %u GL calls per frame, %u GL errors\n",
+				   (f64)(SDL_GetTicks() - stats_time) / stats_frames, gl_totals.calls / stats_frames, gl_totals.errors);
+			printf("    ring: %lu bytes streamed, %u fence waits (%.2f ms), %u wraparounds, %u overflows\n",
+				   renderer.ring.stats.bytes_written, renderer.ring.stats.fence_waits, ns_to_ms(renderer.ring.stats.wait_ns), renderer.ring.stats.wraparounds, renderer.ring.stats.overflows);
+			if (capture) {
+				CaptureStats capture_stats = get_capture_stats(capture);
+				printf("    capture: %u frames written, %u dropped, %u stalls, %.3f ms avg %.3f ms max per frame on the render thread\n",
+					   capture_stats.frames_written, capture_stats.frames_dropped, capture_stats.stalls,
+					   ns_to_ms(capture_stats.render_ns / capture->frame), ns_to_ms(capture_stats.render_max_ns));
+			}
+			memset(&renderer.ring.stats, 0, sizeof(renderer.ring.stats));
+			memset(&upload_totals, 0, sizeof(upload_totals));
+			memset(&gl_totals, 0, sizeof(gl_totals));
+			memset(&stream_totals, 0, sizeof(stream_totals));
+			stats_frames = 0;
+			stats_time = SDL_GetTicks();
+		}
 
-		glUniformMatrix4fv(pv_uniform, 1, GL_FALSE, &pv[0][0]);
-		GL_CHECK(glDrawElementsInstanced(GL_TRIANGLES, size / sizeof(GLushort), GL_UNSIGNED_SHORT, 0, 1));
+		{
+			TRACE_SCOPE("swap_window");
+			SDL_GL_SwapWindow(window);
+		}
+	}
 
-		SDL_GL_SwapWindow(window);
+	if (gpu_timing) {
+		free_gpu_timer(&draw_timer);
 	}
 
+	if (capture) {
+		CaptureStats capture_stats;
+		free_frame_capture(capture, &capture_stats);
+		printf("%u frames recorded to %s, %u dropped, %u failed to write\n",
+			   capture_stats.frames_written, record_dir, capture_stats.frames_dropped, capture_stats.write_failures);
+	}
+	free_renderer(&renderer);
+	free_chunk_stream(stream);
+	free_region_store(regions);
+
+	// Every job has finished, so no thread is recording
+	if (trace_path) {
+		trace_stop();
+		if (write_chrome_trace(trace_path)) {
+			printf("trace written to %s\n", trace_path);
+		} else {
+			printf("could not write trace to %s\n", trace_path);
+		}
+	}
+	destroy_job_system(jobs);
 	SDL_Quit();
 
 	return 0;
@@ -0,0 +1,178 @@
+#ifndef MESHER_H
+#define MESHER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "point.h"
+#include "chunk.h"
+#include "cell_map.h"
+
+// Greedy mesher. Instead of one instanced face per exposed cell face, every
+// exposed face of a cell in pre_render_list is collected per slice and
+// coplanar faces with the same tile id and ambient occlusion are merged into
+// rectangles, giving one indexed vertex/index buffer per chunk.
+
+typedef struct MeshVertex {
+	glm::vec3 position;
+	glm::vec3 color;
+} MeshVertex;
+
+typedef struct ChunkMesh {
+	MeshVertex *vertices;
+	u32 *indices;
+	u32 num_vertices;
+	u32 num_indices;
+	u32 vertex_capacity;
+	u32 index_capacity;
+} ChunkMesh;
+
+void mesh_reserve(ChunkMesh *mesh, u32 vertices, u32 indices) {
+	if (mesh->num_vertices + vertices > mesh->vertex_capacity) {
+		u32 capacity = mesh->vertex_capacity ? mesh->vertex_capacity : 256;
+		while (capacity < mesh->num_vertices + vertices) {
+			capacity *= 2;
+		}
+		mesh->vertices = (MeshVertex *)realloc(mesh->vertices, sizeof(MeshVertex) * capacity);
+		mesh->vertex_capacity = capacity;
+	}
+
+	if (mesh->num_indices + indices > mesh->index_capacity) {
+		u32 capacity = mesh->index_capacity ? mesh->index_capacity : 384;
+		while (capacity < mesh->num_indices + indices) {
+			capacity *= 2;
+		}
+		mesh->indices = (u32 *)realloc(mesh->indices, sizeof(u32) * capacity);
+		mesh->index_capacity = capacity;
+	}
+}
+
+// Emits the given face of the box [origin, origin + size), shading its
+// corners by ao as packed in instances
+void mesh_push_quad(ChunkMesh *mesh, Face face, glm::vec3 origin, glm::vec3 size, glm::vec3 color, u8 ao) {
+	mesh_reserve(mesh, 4, 6);
+
+	u32 base = mesh->num_vertices;
+	for (u32 c = 0; c < 4; c++) {
+		f32 *corner = face_corners[face][c];
+		MeshVertex *v = &mesh->vertices[mesh->num_vertices++];
+		v->position = origin + glm::vec3(corner[0] * size.x, corner[1] * size.y, corner[2] * size.z);
+		v->color = color * ao_levels[(ao >> (2 * c)) & 3];
+	}
+
+	u32 quad_indices[6] = {0, 1, 2, 2, 3, 0};
+	for (u32 i = 0; i < 6; i++) {
+		mesh->indices[mesh->num_indices++] = base + quad_indices[i];
+	}
+}
+
+// Rebuilds mesh from the chunk's pre_render_list, using the exposed faces
+// that hull_chunk recorded in face_masks and the ambient occlusion that
+// update_chunk packed into their instances
+void mesh_chunk(Chunk **chunks, u32 chunk_idx, ChunkMesh *mesh) {
+	TRACE_SCOPE("mesh_chunk");
+	Chunk *chunk = chunks[chunk_idx];
+	mesh->num_vertices = 0;
+	mesh->num_indices = 0;
+
+	// Nothing is marked above the tallest column, so slices stop there
+	i32 top = 0;
+	for (u32 i = 0; i < chunk_width * chunk_depth; i++) {
+		if (chunk->real_blocks[i] > top) {
+			top = chunk->real_blocks[i];
+		}
+	}
+
+	i32 dims[3] = {(i32)chunk_width, top + 1, (i32)chunk_depth};
+	u16 *mask = (u16 *)malloc(sizeof(u16) * chunk_height * (chunk_width > chunk_depth ? chunk_width : chunk_depth));
+
+	for (u32 f = 0; f < NUM_FACES; f++) {
+		i32 *n = face_normals[f];
+		i32 axis = n[0] ? 0 : (n[1] ? 1 : 2);
+		i32 u_axis = (axis + 1) % 3;
+		i32 v_axis = (axis + 2) % 3;
+		i32 u_dim = dims[u_axis];
+		i32 v_dim = dims[v_axis];
+
+		for (i32 slice = 0; slice < dims[axis]; slice++) {
+			// Tile id of every exposed face in this slice with its ambient
+			// occlusion above it, 0 for none
+			for (i32 v = 0; v < v_dim; v++) {
+				for (i32 u = 0; u < u_dim; u++) {
+					i32 c[3];
+					c[axis] = slice;
+					c[u_axis] = u;
+					c[v_axis] = v;
+
+					u32 cell = threed_to_oned(c[0], c[1], c[2], chunk_width, chunk_height);
+					bool exposed = (chunk->face_masks[cell] >> f) & 1;
+					u32 idx;
+					if (!exposed || !cell_map_find(&chunk->mappings, face_key(cell, f), &idx)) {
+						mask[v * u_dim + u] = 0;
+						continue;
+					}
+					mask[v * u_dim + u] = chunk->pre_render_list[cell] | (chunk->instances[idx] >> 24) << 8;
+				}
+			}
+
+			// Greedily grow rectangles of equal faces, first along u then v
+			for (i32 v = 0; v < v_dim; v++) {
+				for (i32 u = 0; u < u_dim;) {
+					u16 face = mask[v * u_dim + u];
+					if (!face) {
+						u++;
+						continue;
+					}
+
+					i32 w = 1;
+					while (u + w < u_dim && mask[v * u_dim + u + w] == face) {
+						w++;
+					}
+
+					i32 h = 1;
+					for (; v + h < v_dim; h++) {
+						bool row_matches = true;
+						for (i32 k = 0; k < w; k++) {
+							if (mask[(v + h) * u_dim + u + k] != face) {
+								row_matches = false;
+								break;
+							}
+						}
+						if (!row_matches) {
+							break;
+						}
+					}
+
+					for (i32 dv = 0; dv < h; dv++) {
+						memset(&mask[(v + dv) * u_dim + u], 0, sizeof(u16) * w);
+					}
+
+					glm::vec3 origin;
+					glm::vec3 size;
+					origin[axis] = slice;
+					origin[u_axis] = u;
+					origin[v_axis] = v;
+					size[axis] = 1;
+					size[u_axis] = w;
+					size[v_axis] = h;
+					origin += glm::vec3(chunk->x_off, 0, chunk->z_off);
+
+					mesh_push_quad(mesh, (Face)f, origin, size, tile_palette[face & 0xFF], face >> 8);
+					u += w;
+				}
+			}
+		}
+	}
+
+	free(mask);
+}
+
+void free_chunk_mesh(ChunkMesh *mesh) {
+	free(mesh->vertices);
+	free(mesh->indices);
+	memset(mesh, 0, sizeof(ChunkMesh));
+}
+
+#endif
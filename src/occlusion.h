@@ -0,0 +1,177 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "culling.h"
+
+// Horizon occlusion for the heightmap terrain. Around the camera the
+// horizon is kept as the steepest slope (rise over horizontal distance) that
+// is known to hit solid ground, per azimuth bin. Chunks are tested nearest
+// first and every chunk also raises the horizon, since each column is solid
+// from the bottom of the world up to at least the chunk's lowest visible cell.
+//
+// The test stays conservative: a chunk only raises the horizon for bins its
+// footprint fully covers, with the flattest slope of its solid part, and only
+// once the tested chunk starts further away than the occluder ends.
+
+#define HORIZON_BINS 2048
+
+typedef struct HorizonEntry {
+	f32 key;
+	u32 idx;
+} HorizonEntry;
+
+typedef struct Horizon {
+	f32 slopes[HORIZON_BINS];
+
+	// Per chunk, rebuilt every pass
+	f32 *min_dist;
+	f32 *angle_lo;
+	f32 *angle_hi;
+	f32 *top_slope;
+	f32 *occluder_slope;
+	HorizonEntry *by_near;
+	HorizonEntry *by_far;
+	u32 count;
+} Horizon;
+
+Horizon *create_horizon(u32 count) {
+	Horizon *horizon = (Horizon *)malloc(sizeof(Horizon));
+	memset(horizon, 0, sizeof(Horizon));
+
+	horizon->min_dist = (f32 *)malloc(sizeof(f32) * count * 5);
+	horizon->angle_lo = horizon->min_dist + count;
+	horizon->angle_hi = horizon->angle_lo + count;
+	horizon->top_slope = horizon->angle_hi + count;
+	horizon->occluder_slope = horizon->top_slope + count;
+	horizon->by_near = (HorizonEntry *)malloc(sizeof(HorizonEntry) * count * 2);
+	horizon->by_far = horizon->by_near + count;
+	horizon->count = count;
+
+	return horizon;
+}
+
+i32 compare_horizon_entry(const void *a, const void *b) {
+	f32 x = ((HorizonEntry *)a)->key;
+	f32 y = ((HorizonEntry *)b)->key;
+	return (x > y) - (x < y);
+}
+
+// Bin units: the full circle spans HORIZON_BINS
+f32 horizon_angle(f32 dx, f32 dz) {
+	return (atan2f(dz, dx) + (f32)M_PI) * (HORIZON_BINS / (2.0f * (f32)M_PI));
+}
+
+// Clears visible[i] for frustum-visible chunks hidden behind nearer terrain,
+// returning how many it cleared
+u32 occlude_chunks(Horizon *horizon, ChunkBounds *bounds, glm::vec3 camera, u8 *visible) {
+	u32 count = bounds->count;
+	u32 num_near = 0;
+	u32 num_far = 0;
+
+	for (u32 i = 0; i < count; i++) {
+		f32 cx = bounds->center_x[i] - camera.x;
+		f32 cz = bounds->center_z[i] - camera.z;
+		f32 ex = bounds->extent_x[i];
+		f32 ez = bounds->extent_z[i];
+
+		f32 nx = fmaxf(fabsf(cx) - ex, 0.0f);
+		f32 nz = fmaxf(fabsf(cz) - ez, 0.0f);
+		f32 near_dist = sqrtf(nx * nx + nz * nz);
+		if (near_dist == 0.0f) {
+			// Camera is above the footprint, it neither hides nor is hidden
+			continue;
+		}
+
+		f32 fx = fabsf(cx) + ex;
+		f32 fz = fabsf(cz) + ez;
+		f32 far_dist = sqrtf(fx * fx + fz * fz);
+
+		// Corners are measured relative to the centre so the span never
+		// wraps; with the camera outside the footprint it is under half a turn
+		f32 center = horizon_angle(cx, cz);
+		f32 lo = 0.0f;
+		f32 hi = 0.0f;
+		for (u32 c = 0; c < 4; c++) {
+			f32 a = horizon_angle(cx + ((c & 1) ? ex : -ex), cz + ((c & 2) ? ez : -ez)) - center;
+			if (a > HORIZON_BINS / 2) {
+				a -= HORIZON_BINS;
+			} else if (a < -HORIZON_BINS / 2) {
+				a += HORIZON_BINS;
+			}
+			lo = fminf(lo, a);
+			hi = fmaxf(hi, a);
+		}
+
+		f32 top = bounds->center_y[i] + bounds->extent_y[i] - camera.y;
+		f32 solid = bounds->center_y[i] - bounds->extent_y[i] + 1.0f - camera.y;
+
+		horizon->min_dist[i] = near_dist;
+		horizon->angle_lo[i] = center + lo;
+		horizon->angle_hi[i] = center + hi;
+		horizon->top_slope[i] = top / (top > 0.0f ? near_dist : far_dist);
+		horizon->occluder_slope[i] = solid / (solid > 0.0f ? far_dist : near_dist);
+
+		horizon->by_far[num_far].key = far_dist;
+		horizon->by_far[num_far].idx = i;
+		num_far++;
+
+		if (visible[i]) {
+			horizon->by_near[num_near].key = near_dist;
+			horizon->by_near[num_near].idx = i;
+			num_near++;
+		}
+	}
+
+	qsort(horizon->by_near, num_near, sizeof(HorizonEntry), compare_horizon_entry);
+	qsort(horizon->by_far, num_far, sizeof(HorizonEntry), compare_horizon_entry);
+
+	for (u32 b = 0; b < HORIZON_BINS; b++) {
+		horizon->slopes[b] = -INFINITY;
+	}
+
+	u32 occluded = 0;
+	u32 next_far = 0;
+	for (u32 n = 0; n < num_near; n++) {
+		u32 i = horizon->by_near[n].idx;
+
+		while (next_far < num_far && horizon->by_far[next_far].key <= horizon->min_dist[i]) {
+			u32 o = horizon->by_far[next_far++].idx;
+			i32 first = (i32)ceilf(horizon->angle_lo[o]);
+			i32 last = (i32)floorf(horizon->angle_hi[o]) - 1;
+			f32 slope = horizon->occluder_slope[o];
+			for (i32 b = first; b <= last; b++) {
+				f32 *s = &horizon->slopes[b & (HORIZON_BINS - 1)];
+				*s = fmaxf(*s, slope);
+			}
+		}
+
+		i32 first = (i32)floorf(horizon->angle_lo[i]);
+		i32 last = (i32)floorf(horizon->angle_hi[i]);
+		f32 slope = horizon->top_slope[i];
+		bool hidden = true;
+		for (i32 b = first; b <= last && hidden; b++) {
+			hidden = slope < horizon->slopes[b & (HORIZON_BINS - 1)];
+		}
+
+		if (hidden) {
+			visible[i] = 0;
+			occluded++;
+		}
+	}
+
+	return occluded;
+}
+
+void free_horizon(Horizon *horizon) {
+	free(horizon->min_dist);
+	free(horizon->by_near);
+	free(horizon);
+}
+
+#endif
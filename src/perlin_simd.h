@@ -0,0 +1,189 @@
+#ifndef PERLIN_SIMD_H
+#define PERLIN_SIMD_H
+
+// Batched version of stb_perlin_noise3. Evaluates PERLIN_LANES samples per
+// step with AVX2 (8 lanes) or SSE4.1 (4 lanes), falling back to the scalar
+// stb function otherwise. Every lane runs exactly the float operations of
+// the stb version in the same order, so results are bit-identical as long
+// as the compiler is not allowed to contract them into FMAs.
+//
+// Must be included after stb_perlin.h with STB_PERLIN_IMPLEMENTATION,
+// since the lattice lookups share stb__perlin_randtab.
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+
+typedef struct PerlinGradients {
+	f32 x[256];
+	f32 y[256];
+	f32 z[256];
+} PerlinGradients;
+
+// Gradient per hash value, pulled out of stb__perlin_grad so the tables
+// always match the scalar version
+PerlinGradients build_perlin_gradients() {
+	PerlinGradients g;
+	for (i32 h = 0; h < 256; h++) {
+		g.x[h] = stb__perlin_grad(h, 1.0f, 0.0f, 0.0f);
+		g.y[h] = stb__perlin_grad(h, 0.0f, 1.0f, 0.0f);
+		g.z[h] = stb__perlin_grad(h, 0.0f, 0.0f, 1.0f);
+	}
+	return g;
+}
+
+const PerlinGradients *perlin_gradients() {
+	static PerlinGradients gradients = build_perlin_gradients();
+	return &gradients;
+}
+
+#if defined(__AVX2__)
+#define PERLIN_LANES 8
+
+typedef __m256 pvf;
+typedef __m256i pvi;
+
+inline pvf pv_load(const f32 *p) { return _mm256_loadu_ps(p); }
+inline void pv_store(f32 *p, pvf a) { _mm256_storeu_ps(p, a); }
+inline pvf pv_set1(f32 a) { return _mm256_set1_ps(a); }
+inline pvi pv_set1i(i32 a) { return _mm256_set1_epi32(a); }
+inline pvf pv_add(pvf a, pvf b) { return _mm256_add_ps(a, b); }
+inline pvf pv_sub(pvf a, pvf b) { return _mm256_sub_ps(a, b); }
+inline pvf pv_mul(pvf a, pvf b) { return _mm256_mul_ps(a, b); }
+inline pvf pv_floor(pvf a) { return _mm256_floor_ps(a); }
+inline pvi pv_to_int(pvf a) { return _mm256_cvttps_epi32(a); }
+inline pvf pv_to_float(pvi a) { return _mm256_cvtepi32_ps(a); }
+inline pvi pv_addi(pvi a, pvi b) { return _mm256_add_epi32(a, b); }
+inline pvi pv_andi(pvi a, pvi b) { return _mm256_and_si256(a, b); }
+inline pvi pv_lookupi(const i32 *table, pvi idx) { return _mm256_i32gather_epi32(table, idx, 4); }
+inline pvf pv_lookupf(const f32 *table, pvi idx) { return _mm256_i32gather_ps(table, idx, 4); }
+
+#elif defined(__SSE4_1__)
+#define PERLIN_LANES 4
+
+typedef __m128 pvf;
+typedef __m128i pvi;
+
+inline pvf pv_load(const f32 *p) { return _mm_loadu_ps(p); }
+inline void pv_store(f32 *p, pvf a) { _mm_storeu_ps(p, a); }
+inline pvf pv_set1(f32 a) { return _mm_set1_ps(a); }
+inline pvi pv_set1i(i32 a) { return _mm_set1_epi32(a); }
+inline pvf pv_add(pvf a, pvf b) { return _mm_add_ps(a, b); }
+inline pvf pv_sub(pvf a, pvf b) { return _mm_sub_ps(a, b); }
+inline pvf pv_mul(pvf a, pvf b) { return _mm_mul_ps(a, b); }
+inline pvf pv_floor(pvf a) { return _mm_floor_ps(a); }
+inline pvi pv_to_int(pvf a) { return _mm_cvttps_epi32(a); }
+inline pvf pv_to_float(pvi a) { return _mm_cvtepi32_ps(a); }
+inline pvi pv_addi(pvi a, pvi b) { return _mm_add_epi32(a, b); }
+inline pvi pv_andi(pvi a, pvi b) { return _mm_and_si128(a, b); }
+
+// SSE has no gather, so table lookups go through the scalar units
+inline pvi pv_lookupi(const i32 *table, pvi idx) {
+	return _mm_setr_epi32(table[_mm_extract_epi32(idx, 0)], table[_mm_extract_epi32(idx, 1)],
+						  table[_mm_extract_epi32(idx, 2)], table[_mm_extract_epi32(idx, 3)]);
+}
+
+inline pvf pv_lookupf(const f32 *table, pvi idx) {
+	return _mm_setr_ps(table[_mm_extract_epi32(idx, 0)], table[_mm_extract_epi32(idx, 1)],
+					   table[_mm_extract_epi32(idx, 2)], table[_mm_extract_epi32(idx, 3)]);
+}
+
+#else
+#define PERLIN_LANES 1
+#endif
+
+#if PERLIN_LANES > 1
+inline pvf pv_lerp(pvf a, pvf b, pvf t) {
+	return pv_add(a, pv_mul(pv_sub(b, a), t));
+}
+
+inline pvf pv_ease(pvf a) {
+	pvf r = pv_sub(pv_mul(a, pv_set1(6.0f)), pv_set1(15.0f));
+	r = pv_add(pv_mul(r, a), pv_set1(10.0f));
+	return pv_mul(pv_mul(pv_mul(r, a), a), a);
+}
+
+inline pvf pv_grad(const PerlinGradients *g, pvi hash, pvf x, pvf y, pvf z) {
+	pvf gx = pv_lookupf(g->x, hash);
+	pvf gy = pv_lookupf(g->y, hash);
+	pvf gz = pv_lookupf(g->z, hash);
+	return pv_add(pv_add(pv_mul(gx, x), pv_mul(gy, y)), pv_mul(gz, z));
+}
+
+void perlin_noise3_lanes(const f32 *xs, const f32 *ys, const f32 *zs, pvi x_mask, pvi y_mask, pvi z_mask, f32 *out) {
+	const PerlinGradients *g = perlin_gradients();
+	const i32 *randtab = stb__perlin_randtab;
+	pvi one = pv_set1i(1);
+	pvf onef = pv_set1(1.0f);
+
+	pvf x = pv_load(xs);
+	pvf y = pv_load(ys);
+	pvf z = pv_load(zs);
+
+	pvi px = pv_to_int(pv_floor(x));
+	pvi py = pv_to_int(pv_floor(y));
+	pvi pz = pv_to_int(pv_floor(z));
+
+	pvi x0 = pv_andi(px, x_mask), x1 = pv_andi(pv_addi(px, one), x_mask);
+	pvi y0 = pv_andi(py, y_mask), y1 = pv_andi(pv_addi(py, one), y_mask);
+	pvi z0 = pv_andi(pz, z_mask), z1 = pv_andi(pv_addi(pz, one), z_mask);
+
+	x = pv_sub(x, pv_to_float(px));
+	y = pv_sub(y, pv_to_float(py));
+	z = pv_sub(z, pv_to_float(pz));
+	pvf u = pv_ease(x);
+	pvf v = pv_ease(y);
+	pvf w = pv_ease(z);
+
+	pvi r0 = pv_lookupi(randtab, x0);
+	pvi r1 = pv_lookupi(randtab, x1);
+
+	pvi r00 = pv_lookupi(randtab, pv_addi(r0, y0));
+	pvi r01 = pv_lookupi(randtab, pv_addi(r0, y1));
+	pvi r10 = pv_lookupi(randtab, pv_addi(r1, y0));
+	pvi r11 = pv_lookupi(randtab, pv_addi(r1, y1));
+
+	pvf x_1 = pv_sub(x, onef);
+	pvf y_1 = pv_sub(y, onef);
+	pvf z_1 = pv_sub(z, onef);
+
+	pvf n000 = pv_grad(g, pv_lookupi(randtab, pv_addi(r00, z0)), x, y, z);
+	pvf n001 = pv_grad(g, pv_lookupi(randtab, pv_addi(r00, z1)), x, y, z_1);
+	pvf n010 = pv_grad(g, pv_lookupi(randtab, pv_addi(r01, z0)), x, y_1, z);
+	pvf n011 = pv_grad(g, pv_lookupi(randtab, pv_addi(r01, z1)), x, y_1, z_1);
+	pvf n100 = pv_grad(g, pv_lookupi(randtab, pv_addi(r10, z0)), x_1, y, z);
+	pvf n101 = pv_grad(g, pv_lookupi(randtab, pv_addi(r10, z1)), x_1, y, z_1);
+	pvf n110 = pv_grad(g, pv_lookupi(randtab, pv_addi(r11, z0)), x_1, y_1, z);
+	pvf n111 = pv_grad(g, pv_lookupi(randtab, pv_addi(r11, z1)), x_1, y_1, z_1);
+
+	pvf n00 = pv_lerp(n000, n001, w);
+	pvf n01 = pv_lerp(n010, n011, w);
+	pvf n10 = pv_lerp(n100, n101, w);
+	pvf n11 = pv_lerp(n110, n111, w);
+
+	pvf n0 = pv_lerp(n00, n01, v);
+	pvf n1 = pv_lerp(n10, n11, v);
+
+	pv_store(out, pv_lerp(n0, n1, u));
+}
+#endif
+
+// out[i] = stb_perlin_noise3(x[i], y[i], z[i], x_wrap, y_wrap, z_wrap)
+void perlin_noise3_batch(const f32 *x, const f32 *y, const f32 *z, u32 count, i32 x_wrap, i32 y_wrap, i32 z_wrap, f32 *out) {
+	u32 i = 0;
+#if PERLIN_LANES > 1
+	pvi x_mask = pv_set1i((x_wrap - 1) & 255);
+	pvi y_mask = pv_set1i((y_wrap - 1) & 255);
+	pvi z_mask = pv_set1i((z_wrap - 1) & 255);
+	for (; i + PERLIN_LANES <= count; i += PERLIN_LANES) {
+		perlin_noise3_lanes(x + i, y + i, z + i, x_mask, y_mask, z_mask, out + i);
+	}
+#endif
+	for (; i < count; i++) {
+		out[i] = stb_perlin_noise3(x[i], y[i], z[i], x_wrap, y_wrap, z_wrap);
+	}
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "chunk.h"
+#include "jobs.h"
+
+// Voxel raycasts (Amanatides & Woo) over the chunks in a slot grid. The ray
+// steps from cell to cell through the faces it crosses, testing each one's
+// occupancy bit, but never visits the cells of a column it passes wholly
+// above, or of a chunk it passes above or that is not loaded: it jumps to
+// the next column or chunk there.
+
+#define RAY_BATCH_SIZE 256
+
+typedef struct RayHit {
+	bool hit;
+	// World position of the solid block the ray stopped in
+	glm::ivec3 block;
+	// Face of that block the ray came in through
+	Face face;
+	f32 distance;
+} RayHit;
+
+typedef struct RayBatch {
+	Chunk **chunks;
+	glm::vec3 *origins;
+	// Normalized
+	glm::vec3 *directions;
+	u32 count;
+	f32 max_distance;
+	RayHit *hits;
+} RayBatch;
+
+typedef struct RayState {
+	glm::vec3 origin;
+	glm::vec3 dir;
+	glm::ivec3 cell;
+	glm::ivec3 step;
+	glm::vec3 t_max;
+	glm::vec3 t_delta;
+} RayState;
+
+// Faces entered when stepping along each axis in the positive direction,
+// and in the negative one
+Face ray_entry_faces[3][2] = {
+	{FACE_LEFT, FACE_RIGHT},
+	{FACE_BOTTOM, FACE_TOP},
+	{FACE_BACK, FACE_FRONT},
+};
+
+i32 floor_div(i32 a, i32 b) {
+	return a >= 0 ? a / b : -((-a - 1) / b) - 1;
+}
+
+// Puts the ray in the cell it is in at distance t. When t is where the ray
+// crosses a boundary on axis, the cell is taken to be the one past it.
+// Cells only ever move along the ray, so rounding at a corner cannot send
+// an axis back across a boundary it already crossed.
+void ray_move_to(RayState *ray, f32 t, i32 axis) {
+	for (i32 a = 0; a < 3; a++) {
+		f32 p = ray->origin[a] + ray->dir[a] * t;
+		i32 cell = (i32)floorf(p);
+		if (a == axis) {
+			cell = (i32)floorf(p + 0.5f) - (ray->step[a] < 0 ? 1 : 0);
+		}
+		if (t > 0.0f && ray->step[a] * (cell - ray->cell[a]) < 0) {
+			cell = ray->cell[a];
+		}
+		ray->cell[a] = cell;
+
+		if (ray->step[a] != 0) {
+			f32 boundary = (f32)(ray->cell[a] + (ray->step[a] > 0 ? 1 : 0));
+			ray->t_max[a] = (boundary - ray->origin[a]) / ray->dir[a];
+		}
+	}
+}
+
+RayHit raycast(Chunk **chunks, glm::vec3 origin, glm::vec3 dir, f32 max_distance) {
+	RayHit result;
+	result.hit = false;
+	result.block = glm::ivec3(0, 0, 0);
+	result.face = FACE_TOP;
+	result.distance = max_distance;
+
+	RayState ray;
+	ray.origin = origin;
+	ray.dir = dir;
+	for (i32 a = 0; a < 3; a++) {
+		ray.step[a] = dir[a] > 0.0f ? 1 : (dir[a] < 0.0f ? -1 : 0);
+		ray.t_delta[a] = ray.step[a] ? fabsf(1.0f / dir[a]) : INFINITY;
+		ray.t_max[a] = INFINITY;
+	}
+	ray_move_to(&ray, 0.0f, -1);
+
+	i32 chunk_x = floor_div(ray.cell.x, chunk_width);
+	i32 chunk_z = floor_div(ray.cell.z, chunk_depth);
+	Chunk *chunk = find_chunk(chunks, chunk_x, chunk_z);
+	Face face = dir.y < 0.0f ? FACE_TOP : FACE_BOTTOM;
+	f32 t = 0.0f;
+
+	while (t <= max_distance) {
+		i32 cx = floor_div(ray.cell.x, chunk_width);
+		i32 cz = floor_div(ray.cell.z, chunk_depth);
+		if (cx != chunk_x || cz != chunk_z) {
+			// Usually one step sideways, which the neighbour links cover
+			if (chunk && abs(cx - chunk_x) + abs(cz - chunk_z) == 1) {
+				chunk = chunk->neighbours[cx != chunk_x ? (cx > chunk_x ? FACE_RIGHT : FACE_LEFT) : (cz > chunk_z ? FACE_FRONT : FACE_BACK)];
+			} else {
+				chunk = find_chunk(chunks, cx, cz);
+			}
+			chunk_x = cx;
+			chunk_z = cz;
+		}
+
+		// Where the ray leaves the chunk's footprint and the column's
+		f32 chunk_exit = INFINITY;
+		i32 chunk_axis = 0;
+		for (i32 a = 0; a < 3; a += 2) {
+			if (ray.step[a] != 0) {
+				i32 size = a == 0 ? chunk_width : chunk_depth;
+				i32 base = (a == 0 ? cx : cz) * size;
+				f32 boundary = (f32)(ray.step[a] > 0 ? base + size : base);
+				f32 exit = (boundary - origin[a]) / dir[a];
+				if (exit < chunk_exit) {
+					chunk_exit = exit;
+					chunk_axis = a;
+				}
+			}
+		}
+		i32 column_axis = ray.t_max.x < ray.t_max.z ? 0 : 2;
+		f32 column_exit = ray.t_max[column_axis];
+
+		i32 top = chunk ? (i32)chunk->top : -1;
+		f32 low_y = origin.y + dir.y * (dir.y < 0.0f ? fminf(chunk_exit, max_distance) : t);
+		if (!chunk || low_y >= (f32)(top + 1)) {
+			if (chunk_exit > max_distance) {
+				break;
+			}
+			t = chunk_exit;
+			ray_move_to(&ray, t, chunk_axis);
+			face = ray_entry_faces[chunk_axis][ray.step[chunk_axis] < 0];
+			continue;
+		}
+
+		u32 column_idx = twod_to_oned(ray.cell.x - chunk->x_off, ray.cell.z - chunk->z_off, chunk_width);
+		i32 height = chunk->real_blocks[column_idx];
+		low_y = origin.y + dir.y * (dir.y < 0.0f ? fminf(column_exit, max_distance) : t);
+		if (low_y >= (f32)(height + 1)) {
+			if (column_exit > max_distance) {
+				break;
+			}
+			t = column_exit;
+			ray_move_to(&ray, t, column_axis);
+			face = ray_entry_faces[column_axis][ray.step[column_axis] < 0];
+			continue;
+		}
+
+		if (ray.cell.y < 0) {
+			break;
+		}
+		if (ray.cell.y <= height && column_solid(chunk->occupancy + column_idx * COLUMN_WORDS, ray.cell.y)) {
+			result.hit = true;
+			result.block = ray.cell;
+			result.face = face;
+			result.distance = t;
+			return result;
+		}
+
+		i32 axis = 0;
+		if (ray.t_max.y < ray.t_max[axis]) {
+			axis = 1;
+		}
+		if (ray.t_max.z < ray.t_max[axis]) {
+			axis = 2;
+		}
+		t = ray.t_max[axis];
+		ray.cell[axis] += ray.step[axis];
+		ray.t_max[axis] += ray.t_delta[axis];
+		face = ray_entry_faces[axis][ray.step[axis] < 0];
+	}
+
+	return result;
+}
+
+// True when nothing solid lies between the two points
+bool line_of_sight(Chunk **chunks, glm::vec3 from, glm::vec3 to) {
+	glm::vec3 d = to - from;
+	f32 distance = glm::length(d);
+	if (distance == 0.0f) {
+		return true;
+	}
+	return !raycast(chunks, from, d / distance, distance).hit;
+}
+
+void raycast_batch(RayBatch *batch, u32 first, u32 count) {
+	for (u32 i = first; i < first + count; i++) {
+		batch->hits[i] = raycast(batch->chunks, batch->origins[i], batch->directions[i], batch->max_distance);
+	}
+}
+
+void raycast_batch_job(void *data, u32 block) {
+	RayBatch *batch = (RayBatch *)data;
+	u32 first = block * RAY_BATCH_SIZE;
+	u32 count = batch->count - first < RAY_BATCH_SIZE ? batch->count - first : RAY_BATCH_SIZE;
+	raycast_batch(batch, first, count);
+}
+
+// Casts the batch in blocks spread over the job system, waiting for every
+// queued job, not only these, before it returns. Chunks must not change
+// until then.
+void raycast_batch_parallel(JobSystem *jobs, RayBatch *batch) {
+	u32 blocks = (batch->count + RAY_BATCH_SIZE - 1) / RAY_BATCH_SIZE;
+	for (u32 b = 0; b < blocks; b++) {
+		push_job(jobs, raycast_batch_job, batch, b);
+	}
+	wait_for_jobs(jobs);
+}
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <mutex>
+
+#include "common.h"
+#include "chunk.h"
+
+// On-disk chunk storage. Chunks are grouped REGION_SIDE x REGION_SIDE to a
+// file, r.<rx>.<rz>.region in the store's directory, which starts with a
+// header holding the offset and size of every chunk's record (0 for chunks
+// never saved). Files are mapped read-only, so loading a chunk touches the
+// header and that chunk's record and nothing else.
+//
+// Saving appends the new record and then points the header entry at it, so
+// a save cut short leaves the old record in use. Records that were replaced
+// stay behind as dead space.
+//
+// A record holds the chunk's cells column by column, bottom to top, as the
+// palette of block ids it uses followed by runs of palette indices:
+// u16 palette size, u16 zero, u32 run count, the palette, then a u16 length
+// and a u8 palette index per run. Fields are little-endian and unaligned.
+
+#define REGION_SIDE 32
+#define REGION_CHUNKS (REGION_SIDE * REGION_SIDE)
+#define REGION_MAGIC 0x47525856
+#define REGION_VERSION 1
+#define MAX_OPEN_REGIONS 16
+
+#define BLOCK_AIR 0
+#define BLOCK_SOLID 1
+
+typedef struct RegionEntry {
+	u32 offset;
+	u32 size;
+} RegionEntry;
+
+typedef struct RegionHeader {
+	u32 magic;
+	u32 version;
+	// Chunk dimensions the file was written with
+	u32 chunk_width;
+	u32 chunk_height;
+	u32 chunk_depth;
+	RegionEntry entries[REGION_CHUNKS];
+} RegionHeader;
+
+typedef struct Region {
+	i32 rx;
+	i32 rz;
+	// -1 until the file exists
+	i32 fd;
+	// Set for files written with another format, which are never touched
+	bool unusable;
+	u8 *data;
+	u64 mapped_size;
+	u64 file_size;
+	RegionEntry entries[REGION_CHUNKS];
+} Region;
+
+typedef struct RegionStore {
+	char *dir;
+	// Most recently used last; the first is closed to make room
+	Region *regions[MAX_OPEN_REGIONS];
+	u32 num_regions;
+	// Encoding space for one chunk
+	u8 *ids;
+	u8 *record;
+	// Loads come from job threads, saves from the main thread
+	std::mutex lock;
+
+	u32 chunks_read;
+	u32 chunks_written;
+	u64 bytes_written;
+} RegionStore;
+
+// Floor division, so chunk -1 is in region -1
+i32 region_coord(i32 c) {
+	return c >= 0 ? c / REGION_SIDE : -((-c - 1) / REGION_SIDE) - 1;
+}
+
+u32 region_entry_idx(i32 cx, i32 cz) {
+	return twod_to_oned(cx - region_coord(cx) * REGION_SIDE, cz - region_coord(cz) * REGION_SIDE, REGION_SIDE);
+}
+
+void region_path(RegionStore *store, i32 rx, i32 rz, char *path, u32 path_size) {
+	snprintf(path, path_size, "%s/r.%d.%d.region", store->dir, rx, rz);
+}
+
+u32 max_record_size() {
+	return 8 + 256 + chunk_size * 3;
+}
+
+// Every cell in record order, written a run of equal bits at a time
+void chunk_block_ids(Chunk *chunk, u8 *ids) {
+	for (u32 c = 0; c < chunk_width * chunk_depth; c++) {
+		u8 *column = ids + c * chunk_height;
+		u64 *bits = chunk->occupancy + c * COLUMN_WORDS;
+		u32 y = 0;
+		while (y < chunk_height) {
+			bool solid = column_solid(bits, y);
+			// Bits that differ from this cell's, past it
+			u32 end = chunk_height;
+			for (u32 w = y / 64; w < COLUMN_WORDS; w++) {
+				u64 differ = (solid ? ~bits[w] : bits[w]) & (w == y / 64 ? ~0ul << (y % 64) : ~0ul);
+				if (differ) {
+					end = w * 64 + __builtin_ctzl(differ);
+					break;
+				}
+			}
+			memset(column + y, solid ? BLOCK_SOLID : BLOCK_AIR, end - y);
+			y = end;
+		}
+	}
+}
+
+// Returns the record size, at most max_record_size()
+u32 encode_blocks(u8 *ids, u32 count, u8 *record) {
+	u16 index_of[256];
+	u8 palette[256];
+	u16 palette_size = 0;
+	memset(index_of, 0xFF, sizeof(index_of));
+
+	// Runs are written after room for the largest palette and moved down
+	// once the palette is known
+	u8 *runs = record + 8 + 256;
+	u8 *run = runs;
+	u32 num_runs = 0;
+	for (u32 i = 0; i < count;) {
+		u8 id = ids[i];
+		u64 pattern = 0x0101010101010101ull * id;
+		u32 limit = count - i < 0xFFFF ? count : i + 0xFFFF;
+		u32 end = i + 1;
+		// Eight cells at a time through the long runs of air and stone
+		while (end + 8 <= limit) {
+			u64 word;
+			memcpy(&word, ids + end, sizeof(word));
+			if (word != pattern) {
+				break;
+			}
+			end += 8;
+		}
+		while (end < limit && ids[end] == id) {
+			end++;
+		}
+
+		if (index_of[id] == 0xFFFF) {
+			index_of[id] = palette_size;
+			palette[palette_size++] = id;
+		}
+
+		u16 length = end - i;
+		memcpy(run, &length, sizeof(length));
+		run[2] = index_of[id];
+		run += 3;
+		num_runs++;
+		i = end;
+	}
+
+	u16 zero = 0;
+	memcpy(record, &palette_size, sizeof(palette_size));
+	memcpy(record + 2, &zero, sizeof(zero));
+	memcpy(record + 4, &num_runs, sizeof(num_runs));
+	memcpy(record + 8, palette, palette_size);
+	memmove(record + 8 + palette_size, runs, run - runs);
+	return 8 + palette_size + (run - runs);
+}
+
+// Any block other than air is solid. Returns false for a record that does
+// not cover exactly one chunk, or leaves a column without its bottom cell.
+bool decode_blocks(u8 *record, u32 size, Chunk *chunk) {
+	if (size < 8) {
+		return false;
+	}
+
+	u16 palette_size;
+	u32 num_runs;
+	memcpy(&palette_size, record, sizeof(palette_size));
+	memcpy(&num_runs, record + 4, sizeof(num_runs));
+	if (palette_size > 256 || (u64)size != 8 + (u64)palette_size + (u64)num_runs * 3) {
+		return false;
+	}
+
+	u8 *palette = record + 8;
+	u8 *run = palette + palette_size;
+	memset(chunk->occupancy, 0, sizeof(u64) * chunk_width * chunk_depth * COLUMN_WORDS);
+
+	u32 cell = 0;
+	for (u32 r = 0; r < num_runs; r++, run += 3) {
+		u16 length;
+		memcpy(&length, run, sizeof(length));
+		u8 index = run[2];
+		if (index >= palette_size || length == 0 || length > chunk_size - cell) {
+			return false;
+		}
+
+		if (palette[index] != BLOCK_AIR) {
+			u32 last = cell + length - 1;
+			for (u32 c = cell / chunk_height; c <= last / chunk_height; c++) {
+				u32 from = cell > c * chunk_height ? cell - c * chunk_height : 0;
+				u32 to = (last < (c + 1) * chunk_height - 1 ? last : (c + 1) * chunk_height - 1) - c * chunk_height + 1;
+				fill_column(chunk->occupancy + c * COLUMN_WORDS, from, to);
+			}
+		}
+		cell += length;
+	}
+
+	if (cell != chunk_size) {
+		return false;
+	}
+
+	for (u32 c = 0; c < chunk_width * chunk_depth; c++) {
+		i32 height = highest_solid(chunk->occupancy + c * COLUMN_WORDS);
+		if (height < 0 || !column_solid(chunk->occupancy + c * COLUMN_WORDS, 0)) {
+			return false;
+		}
+		chunk->real_blocks[c] = height;
+	}
+	return true;
+}
+
+bool map_region(Region *region) {
+	if (region->data) {
+		munmap(region->data, region->mapped_size);
+		region->data = NULL;
+		region->mapped_size = 0;
+	}
+
+	void *data = mmap(NULL, region->file_size, PROT_READ, MAP_SHARED, region->fd, 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	region->data = (u8 *)data;
+	region->mapped_size = region->file_size;
+	return true;
+}
+
+// Missing files give an empty region, created on the first save
+Region *open_region(RegionStore *store, i32 rx, i32 rz) {
+	Region *region = (Region *)calloc(1, sizeof(Region));
+	region->rx = rx;
+	region->rz = rz;
+
+	char path[512];
+	region_path(store, rx, rz, path, sizeof(path));
+	region->fd = open(path, O_RDWR);
+	if (region->fd < 0) {
+		return region;
+	}
+
+	struct stat st;
+	RegionHeader *header = NULL;
+	if (fstat(region->fd, &st) == 0 && (u64)st.st_size >= sizeof(RegionHeader)) {
+		region->file_size = st.st_size;
+		if (map_region(region)) {
+			header = (RegionHeader *)region->data;
+		}
+	}
+
+	if (!header || header->magic != REGION_MAGIC || header->version != REGION_VERSION ||
+		header->chunk_width != chunk_width || header->chunk_height != chunk_height || header->chunk_depth != chunk_depth) {
+		printf("Region file %s is unreadable, its chunks will be generated\n", path);
+		region->unusable = true;
+		return region;
+	}
+
+	memcpy(region->entries, header->entries, sizeof(region->entries));
+	return region;
+}
+
+void close_region(Region *region) {
+	if (region->data) {
+		munmap(region->data, region->mapped_size);
+	}
+	if (region->fd >= 0) {
+		close(region->fd);
+	}
+	free(region);
+}
+
+bool create_region_file(RegionStore *store, Region *region) {
+	char path[512];
+	region_path(store, region->rx, region->rz, path, sizeof(path));
+	region->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (region->fd < 0) {
+		printf("Could not create region file %s\n", path);
+		region->unusable = true;
+		return false;
+	}
+
+	RegionHeader *header = (RegionHeader *)calloc(1, sizeof(RegionHeader));
+	header->magic = REGION_MAGIC;
+	header->version = REGION_VERSION;
+	header->chunk_width = chunk_width;
+	header->chunk_height = chunk_height;
+	header->chunk_depth = chunk_depth;
+	bool written = pwrite(region->fd, header, sizeof(RegionHeader), 0) == (ssize_t)sizeof(RegionHeader);
+	free(header);
+
+	region->file_size = sizeof(RegionHeader);
+	region->unusable = !written;
+	return written;
+}
+
+// Caller holds the store's lock
+Region *get_region(RegionStore *store, i32 rx, i32 rz) {
+	for (u32 i = 0; i < store->num_regions; i++) {
+		Region *region = store->regions[i];
+		if (region->rx == rx && region->rz == rz) {
+			memmove(&store->regions[i], &store->regions[i + 1], sizeof(Region *) * (store->num_regions - i - 1));
+			store->regions[store->num_regions - 1] = region;
+			return region;
+		}
+	}
+
+	if (store->num_regions == MAX_OPEN_REGIONS) {
+		close_region(store->regions[0]);
+		memmove(&store->regions[0], &store->regions[1], sizeof(Region *) * (MAX_OPEN_REGIONS - 1));
+		store->num_regions--;
+	}
+
+	Region *region = open_region(store, rx, rz);
+	store->regions[store->num_regions++] = region;
+	return region;
+}
+
+// Creates the directory if it does not exist yet
+RegionStore *create_region_store(const char *dir) {
+	mkdir(dir, 0755);
+
+	RegionStore *store = new RegionStore();
+	store->dir = strdup(dir);
+	store->num_regions = 0;
+	store->ids = (u8 *)malloc(chunk_size);
+	store->record = (u8 *)malloc(max_record_size());
+	store->chunks_read = 0;
+	store->chunks_written = 0;
+	store->bytes_written = 0;
+	return store;
+}
+
+// The saved chunk at (cx, cz), not yet hulled, or NULL when there is none
+Chunk *load_region_chunk(RegionStore *store, i32 cx, i32 cz) {
+	std::lock_guard<std::mutex> guard(store->lock);
+	Region *region = get_region(store, region_coord(cx), region_coord(cz));
+	RegionEntry entry = region->entries[region_entry_idx(cx, cz)];
+	if (region->unusable || entry.size == 0) {
+		return NULL;
+	}
+
+	if ((u64)entry.offset + entry.size > region->mapped_size && !map_region(region)) {
+		return NULL;
+	}
+
+	Chunk *chunk = new_chunk(cx, cz);
+	if (!decode_blocks(region->data + entry.offset, entry.size, chunk)) {
+		free_chunk(chunk);
+		return NULL;
+	}
+	update_chunk_top(chunk);
+
+	chunk->saved = true;
+	store->chunks_read++;
+	return chunk;
+}
+
+bool save_region_chunk(RegionStore *store, Chunk *chunk) {
+	std::lock_guard<std::mutex> guard(store->lock);
+	i32 cx = chunk->x_off / (i32)chunk_width;
+	i32 cz = chunk->z_off / (i32)chunk_depth;
+	Region *region = get_region(store, region_coord(cx), region_coord(cz));
+	if (region->unusable || (region->fd < 0 && !create_region_file(store, region))) {
+		return false;
+	}
+
+	chunk_block_ids(chunk, store->ids);
+	u32 size = encode_blocks(store->ids, chunk_size, store->record);
+	if (region->file_size + size > 0xFFFFFFFFull) {
+		return false;
+	}
+
+	u32 idx = region_entry_idx(cx, cz);
+	RegionEntry entry;
+	entry.offset = (u32)region->file_size;
+	entry.size = size;
+	if (pwrite(region->fd, store->record, size, entry.offset) != (ssize_t)size) {
+		return false;
+	}
+	if (pwrite(region->fd, &entry, sizeof(entry), offsetof(RegionHeader, entries) + sizeof(RegionEntry) * idx) != (ssize_t)sizeof(entry)) {
+		return false;
+	}
+
+	region->file_size += size;
+	region->entries[idx] = entry;
+	chunk->saved = true;
+	store->chunks_written++;
+	store->bytes_written += size;
+	return true;
+}
+
+void free_region_store(RegionStore *store) {
+	for (u32 i = 0; i < store->num_regions; i++) {
+		close_region(store->regions[i]);
+	}
+	free(store->dir);
+	free(store->ids);
+	free(store->record);
+	delete store;
+}
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "common.h"
+#include "chunk.h"
+#include "streaming.h"
+#include "chunk_gpu.h"
+#include "ring_buffer.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "cube.h"
+#include "trace.h"
+#include "gl_helper.h"
+
+// Draws the streamed world into whatever framebuffer is bound: culls and
+// picks a level for every chunk, uploads what changed, then draws the
+// chunks and the HUD block. Shared by the window and the headless runner,
+// which only differ in where the camera comes from and where frames go.
+
+typedef struct Renderer {
+	i32 width;
+	i32 height;
+	RenderMode render_mode;
+
+	GLuint obj_shader_program;
+	GLuint mesh_shader_program;
+	GLuint vao;
+	GLuint vbo_cube_points;
+	GLuint ibo_cube_indices;
+	GLuint vbo_hud_instance;
+
+	GLuint points_attr;
+	GLuint instance_attr;
+	GLuint mesh_points_attr;
+	GLuint mesh_color_attr;
+	GLuint pv_uniform;
+	GLuint chunk_offset_uniform;
+	GLuint mesh_pv_uniform;
+
+	ChunkBuffers *chunk_buffers;
+	ChunkMesh *chunk_meshes;
+	InstancePool instance_pool;
+	RingBuffer ring;
+	ChunkDraws chunk_draws;
+
+	ChunkBounds chunk_bounds;
+	u8 *chunk_visible;
+	Horizon *horizon;
+	u8 *chunk_lods;
+
+	// Times the draw section when set
+	GpuTimer *draw_timer;
+
+	// Of the last frame
+	CullStats cull_stats;
+	UploadStats upload_stats;
+} Renderer;
+
+// Needs the streamed world's num_chunks, and shaders under src/
+void init_renderer(Renderer *r, i32 width, i32 height, DrawPath max_draw_path) {
+	memset(r, 0, sizeof(Renderer));
+	r->width = width;
+	r->height = height;
+	r->render_mode = RENDER_INSTANCED;
+
+	r->obj_shader_program = load_and_build_program("src/obj_vert.vsh", "src/obj_frag.fsh");
+	r->mesh_shader_program = load_and_build_program("src/mesh_vert.vsh", "src/obj_frag.fsh");
+
+	glGenVertexArrays(1, &r->vao);
+	glBindVertexArray(r->vao);
+
+	glGenBuffers(1, &r->vbo_cube_points);
+	glBindBuffer(GL_ARRAY_BUFFER, r->vbo_cube_points);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_points), cube_points, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &r->ibo_cube_indices);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ibo_cube_indices);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_indices), cube_indices, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &r->vbo_hud_instance);
+
+	r->points_attr = glGetAttribLocation(r->obj_shader_program, "coords");
+	r->instance_attr = glGetAttribLocation(r->obj_shader_program, "instance");
+	r->mesh_points_attr = glGetAttribLocation(r->mesh_shader_program, "coords");
+	r->mesh_color_attr = glGetAttribLocation(r->mesh_shader_program, "color");
+	r->pv_uniform = glGetUniformLocation(r->obj_shader_program, "pv");
+	r->chunk_offset_uniform = glGetUniformLocation(r->obj_shader_program, "chunk_offset");
+	r->mesh_pv_uniform = glGetUniformLocation(r->mesh_shader_program, "pv");
+
+	glUseProgram(r->obj_shader_program);
+	glUniform3fv(glGetUniformLocation(r->obj_shader_program, "palette"), NUM_TILES, &tile_palette[0][0]);
+	glUniform1fv(glGetUniformLocation(r->obj_shader_program, "ao_levels"), 4, ao_levels);
+
+	glViewport(0, 0, width, height);
+	glEnable(GL_CULL_FACE);
+
+	r->chunk_buffers = create_chunk_buffers(num_chunks);
+	r->chunk_meshes = (ChunkMesh *)calloc(num_chunks, sizeof(ChunkMesh));
+	init_instance_pool(&r->instance_pool, num_chunks * 1024);
+	// Room for a frame's uploads even when the last one overshoots the budget
+	init_ring_buffer(&r->ring, 2 * upload_budget_bytes);
+	init_chunk_draws(&r->chunk_draws, num_chunks, max_draw_path);
+
+	r->chunk_bounds = create_chunk_bounds(num_chunks);
+	r->chunk_visible = (u8 *)malloc(num_chunks);
+	r->horizon = create_horizon(num_chunks);
+	r->chunk_lods = (u8 *)calloc(num_chunks, 1);
+}
+
+void render_world(Renderer *r, ChunkStream *stream, glm::vec3 camera_pos, glm::vec3 camera_front, glm::vec3 camera_up) {
+	Chunk **chunks = stream->chunks;
+
+	GL_CHECK(glEnable(GL_DEPTH_TEST));
+	GL_CHECK(glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT));
+
+	// Bounds follow the CPU data, so refresh them while the dirty flags
+	// are still set
+	for (u32 i = 0; i < num_chunks; i++) {
+		if (!chunk_ready(stream, i)) {
+			clear_chunk_bounds(&r->chunk_bounds, i);
+		} else if (chunks[i]->dirty || chunks[i]->mesh_dirty) {
+			set_chunk_bounds(&r->chunk_bounds, i, chunks[i]);
+		}
+	}
+
+	i32 size;
+
+	glm::mat4 perspective;
+	perspective = glm::perspective(glm::radians(45.0f), (f32)r->width / (f32)r->height, 0.1f, 5000.0f);
+	glm::mat4 view;
+	view = glm::lookAt(camera_pos, camera_pos + camera_front, camera_up);
+	glm::mat4 pv = perspective * view;
+
+	Frustum frustum = frustum_from_matrix(pv);
+	cull_chunks(&r->chunk_bounds, &frustum, r->chunk_visible);
+
+	CullStats *cull_stats = &r->cull_stats;
+	u32 num_ready = 0;
+	cull_stats->drawn = 0;
+	for (u32 i = 0; i < num_chunks; i++) {
+		r->chunk_visible[i] &= (u8)chunk_ready(stream, i);
+		num_ready += chunk_ready(stream, i);
+		cull_stats->drawn += r->chunk_visible[i];
+	}
+	cull_stats->culled = num_ready - cull_stats->drawn;
+	cull_stats->occluded = occlude_chunks(r->horizon, &r->chunk_bounds, camera_pos, r->chunk_visible);
+	cull_stats->drawn -= cull_stats->occluded;
+
+	update_chunk_lods(&r->chunk_bounds, camera_pos, r->chunk_lods);
+
+	// Hidden chunks are neither drawn nor uploaded
+	memset(&r->upload_stats, 0, sizeof(r->upload_stats));
+	ring_begin_frame(&r->ring);
+	if (r->render_mode == RENDER_GREEDY_MESH) {
+		upload_dirty_meshes(&r->ring, chunks, r->chunk_meshes, r->chunk_buffers, r->chunk_visible, r->chunk_lods, 0, num_chunks, &r->upload_stats);
+	} else {
+		upload_dirty_chunks(&r->instance_pool, &r->ring, chunks, r->chunk_buffers, r->chunk_visible, r->chunk_lods, num_chunks, &r->upload_stats);
+		upload_dirty_meshes(&r->ring, chunks, r->chunk_meshes, r->chunk_buffers, r->chunk_visible, r->chunk_lods, 1, num_chunks, &r->upload_stats);
+	}
+
+	TRACE_BEGIN(draw_section, "draw");
+	if (r->draw_timer) {
+		begin_gpu_timer(r->draw_timer);
+	}
+
+	// Mesh vertices are already in world space with a colour each. Greedy
+	// mode draws every chunk from its mesh, instanced mode only the chunks
+	// past full detail, from their LOD mesh
+	GL_CHECK(glUseProgram(r->mesh_shader_program));
+	GL_CHECK(glUniformMatrix4fv(r->mesh_pv_uniform, 1, GL_FALSE, &pv[0][0]));
+
+	GL_CHECK(glEnableVertexAttribArray(r->mesh_points_attr));
+	GL_CHECK(glEnableVertexAttribArray(r->mesh_color_attr));
+	GL_CHECK(glVertexAttribDivisor(r->mesh_points_attr, 0));
+	GL_CHECK(glVertexAttribDivisor(r->mesh_color_attr, 0));
+
+	for (u32 i = 0; i < num_chunks; i++) {
+		bool from_mesh = r->render_mode == RENDER_GREEDY_MESH || r->chunk_lods[i] > 0;
+		if (!from_mesh || !r->chunk_visible[i] || r->chunk_buffers[i].num_mesh_indices == 0) {
+			continue;
+		}
+
+		TRACE_SCOPE("draw_chunk_mesh");
+		GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, r->chunk_buffers[i].vbo_mesh));
+		GL_CHECK(glVertexAttribPointer(r->mesh_points_attr, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void *)offsetof(MeshVertex, position)));
+		GL_CHECK(glVertexAttribPointer(r->mesh_color_attr, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void *)offsetof(MeshVertex, color)));
+
+		GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->chunk_buffers[i].ibo_mesh));
+		GL_CHECK(glDrawElements(GL_TRIANGLES, r->chunk_buffers[i].num_mesh_indices, GL_UNSIGNED_INT, 0));
+	}
+
+	GL_CHECK(glDisableVertexAttribArray(r->mesh_points_attr));
+	GL_CHECK(glDisableVertexAttribArray(r->mesh_color_attr));
+
+	GL_CHECK(glUseProgram(r->obj_shader_program));
+	GL_CHECK(glUniformMatrix4fv(r->pv_uniform, 1, GL_FALSE, &pv[0][0]));
+
+	GL_CHECK(glEnableVertexAttribArray(r->points_attr));
+	GL_CHECK(glEnableVertexAttribArray(r->instance_attr));
+	GL_CHECK(glVertexAttribDivisor(r->points_attr, 0));
+	GL_CHECK(glVertexAttribDivisor(r->instance_attr, 1));
+
+	GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ibo_cube_indices));
+	GL_CHECK(glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size));
+
+	if (r->render_mode == RENDER_INSTANCED) {
+		// Slot points carry each chunk's origin
+		GL_CHECK(glUniform3f(r->chunk_offset_uniform, 0.0f, 0.0f, 0.0f));
+		draw_chunk_instances(&r->chunk_draws, &r->instance_pool, &r->ring, r->chunk_buffers, r->chunk_visible, r->chunk_lods, num_chunks, r->points_attr, r->instance_attr);
+	}
+
+	GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, r->vbo_cube_points));
+	GL_CHECK(glVertexAttribPointer(r->points_attr, 3, GL_FLOAT, GL_FALSE, 0, 0));
+
+	GL_CHECK(glDisable(GL_DEPTH_TEST));
+
+	pv = glm::ortho(-66.5f, 66.5f, -37.6f, 37.6f, -1.0f, 1.0f);
+
+	// The HUD block is the only data streamed every frame
+	u32 hud_instance = pack_instance(0, 0, 0, TILE_WHITE, AO_LIT);
+	glm::vec3 hud_position = glm::vec3(0.1, 0.0, 0.0);
+
+	u64 hud_offset;
+	u32 *hud_mapped = (u32 *)ring_alloc(&r->ring, sizeof(u32), &hud_offset);
+	if (hud_mapped) {
+		*hud_mapped = hud_instance;
+		ring_commit(&r->ring);
+		GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, r->ring.buffer));
+		GL_CHECK(glVertexAttribIPointer(r->instance_attr, 1, GL_UNSIGNED_INT, 0, (void *)hud_offset));
+	} else {
+		GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, r->vbo_hud_instance));
+		GL_CHECK(glBufferData(GL_ARRAY_BUFFER, sizeof(u32), &hud_instance, GL_STREAM_DRAW));
+		GL_CHECK(glVertexAttribIPointer(r->instance_attr, 1, GL_UNSIGNED_INT, 0, 0));
+	}
+
+	GL_CHECK(glUniformMatrix4fv(r->pv_uniform, 1, GL_FALSE, &pv[0][0]));
+	GL_CHECK(glUniform3f(r->chunk_offset_uniform, hud_position.x, hud_position.y, hud_position.z));
+	GL_CHECK(glDrawElementsInstanced(GL_TRIANGLES, size / sizeof(GLushort), GL_UNSIGNED_SHORT, 0, 1));
+
+	GL_CHECK(glDisableVertexAttribArray(r->points_attr));
+	GL_CHECK(glDisableVertexAttribArray(r->instance_attr));
+
+	ring_end_frame(&r->ring);
+
+	if (r->draw_timer) {
+		end_gpu_timer(r->draw_timer);
+	}
+	TRACE_END(draw_section);
+}
+
+void free_renderer(Renderer *r) {
+	for (u32 i = 0; i < num_chunks; i++) {
+		free_chunk_mesh(&r->chunk_meshes[i]);
+	}
+	free(r->chunk_meshes);
+	free(r->chunk_lods);
+	free_horizon(r->horizon);
+	free(r->chunk_visible);
+	free_chunk_bounds(&r->chunk_bounds);
+	free_chunk_draws(&r->chunk_draws);
+	free_ring_buffer(&r->ring);
+	free_instance_pool(&r->instance_pool);
+	free_chunk_buffers(r->chunk_buffers, num_chunks);
+
+	glDeleteBuffers(1, &r->vbo_cube_points);
+	glDeleteBuffers(1, &r->ibo_cube_indices);
+	glDeleteBuffers(1, &r->vbo_hud_instance);
+	glDeleteVertexArrays(1, &r->vao);
+	glDeleteProgram(r->obj_shader_program);
+	glDeleteProgram(r->mesh_shader_program);
+}
+
+#endif
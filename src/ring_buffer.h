@@ -0,0 +1,194 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <string.h>
+
+#include "common.h"
+#include "timer.h"
+#include "trace.h"
+#include "gl_helper.h"
+
+// Streaming buffer for data written once per frame. It is split into
+// RING_REGIONS regions, one per frame in flight; each frame allocates from
+// its own region, and ring_end_frame fences it, so a region is only written
+// again once the GPU has finished the frame that last used it.
+//
+// With glBufferStorage (GL 4.4 or ARB_buffer_storage) the whole buffer stays
+// mapped, persistent and coherent, and ring_alloc hands out a pointer into
+// it. Without, each allocation is mapped unsynchronized on its own, which
+// the fences make just as safe. Either way producers write straight into
+// driver memory; ring_commit must follow every ring_alloc before GL reads
+// the data, and only one allocation may be open at a time.
+
+#define RING_REGIONS 3
+#define RING_ALIGN 16
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (GL_HELPER_APIENTRY *GlBufferStorageFunc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+typedef struct RingStats {
+	u64 bytes_written;
+	// Frames that found their region still in use by the GPU, and how long
+	// they waited for it
+	u32 fence_waits;
+	u64 wait_ns;
+	// Times the ring came back round to its first region
+	u32 wraparounds;
+	// Allocations that did not fit in what was left of the frame's region
+	u32 overflows;
+} RingStats;
+
+// Cleared before init_ring_buffer to use the per-allocation mapping even
+// where glBufferStorage is available
+bool ring_allow_persistent = true;
+
+typedef struct RingBuffer {
+	GLuint buffer;
+	bool persistent;
+	// The whole buffer when persistent, else the open allocation
+	u8 *mapped;
+	u64 region_size;
+	u32 region;
+	// Next free byte in the current region
+	u64 head;
+	GLsync fences[RING_REGIONS];
+	RingStats stats;
+} RingBuffer;
+
+void init_ring_buffer(RingBuffer *ring, u64 region_size) {
+	memset(ring, 0, sizeof(RingBuffer));
+	ring->region_size = (region_size + RING_ALIGN - 1) & ~(u64)(RING_ALIGN - 1);
+	u64 size = ring->region_size * RING_REGIONS;
+
+	GlBufferStorageFunc buffer_storage = NULL;
+	if (ring_allow_persistent && (gl_version() >= 44 || gl_has_extension("GL_ARB_buffer_storage"))) {
+		buffer_storage = (GlBufferStorageFunc)gl_proc_address("glBufferStorage");
+	}
+
+	GL_CHECK(glGenBuffers(1, &ring->buffer));
+	GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, ring->buffer));
+	if (buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		GL_CHECK(buffer_storage(GL_COPY_READ_BUFFER, size, NULL, flags));
+		GL_CHECK(ring->mapped = (u8 *)glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, flags));
+		ring->persistent = ring->mapped != NULL;
+	}
+	if (!ring->persistent) {
+		GL_CHECK(glBufferData(GL_COPY_READ_BUFFER, size, NULL, GL_STREAM_DRAW));
+		ring->mapped = NULL;
+	}
+
+	// Frames start by moving on a region
+	ring->region = RING_REGIONS - 1;
+}
+
+// Moves to the next region, waiting for the GPU to finish the frame that
+// used it last
+void ring_begin_frame(RingBuffer *ring) {
+	TRACE_SCOPE("ring_begin_frame");
+	ring->region = (ring->region + 1) % RING_REGIONS;
+	ring->head = 0;
+
+	GLsync fence = ring->fences[ring->region];
+	if (!fence) {
+		return;
+	}
+	if (ring->region == 0) {
+		ring->stats.wraparounds++;
+	}
+
+	GLenum status = glClientWaitSync(fence, 0, 0);
+	if (status == GL_TIMEOUT_EXPIRED) {
+		u64 start = get_time_ns();
+		ring->stats.fence_waits++;
+		do {
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		} while (status == GL_TIMEOUT_EXPIRED);
+		ring->stats.wait_ns += get_time_ns() - start;
+	}
+	GL_CHECK(glDeleteSync(fence));
+	ring->fences[ring->region] = NULL;
+}
+
+// Fences the frame's region after its last GL call that reads the ring
+void ring_end_frame(RingBuffer *ring) {
+	GL_CHECK(ring->fences[ring->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+}
+
+// Returns memory for bytes of data at *offset in ring->buffer, or NULL when
+// the frame's region has no room left
+void *ring_alloc(RingBuffer *ring, u64 bytes, u64 *offset) {
+	u64 start = (ring->head + RING_ALIGN - 1) & ~(u64)(RING_ALIGN - 1);
+	if (start + bytes > ring->region_size) {
+		ring->stats.overflows++;
+		return NULL;
+	}
+
+	ring->head = start + bytes;
+	*offset = ring->region * ring->region_size + start;
+	ring->stats.bytes_written += bytes;
+
+	if (ring->persistent) {
+		return ring->mapped + *offset;
+	}
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+	GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, ring->buffer));
+	GL_CHECK(ring->mapped = (u8 *)glMapBufferRange(GL_COPY_READ_BUFFER, *offset, bytes, flags));
+	return ring->mapped;
+}
+
+// Hands the open allocation over to GL
+void ring_commit(RingBuffer *ring) {
+	if (!ring->persistent) {
+		GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, ring->buffer));
+		GL_CHECK(glUnmapBuffer(GL_COPY_READ_BUFFER));
+		ring->mapped = NULL;
+	}
+}
+
+// Copies bytes of data to dst_offset in buffer through the ring, falling
+// back to glBufferSubData when the region is full. Leaves buffer bound to
+// GL_COPY_WRITE_BUFFER.
+void ring_upload(RingBuffer *ring, GLuint buffer, u64 dst_offset, const void *data, u64 bytes) {
+	if (bytes == 0) {
+		return;
+	}
+
+	u64 offset;
+	void *dst = ring_alloc(ring, bytes, &offset);
+	GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, buffer));
+	if (!dst) {
+		GL_CHECK(glBufferSubData(GL_COPY_WRITE_BUFFER, dst_offset, bytes, data));
+		return;
+	}
+
+	memcpy(dst, data, bytes);
+	ring_commit(ring);
+	GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, ring->buffer));
+	GL_CHECK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, dst_offset, bytes));
+}
+
+// Waits for every frame in flight, then unmaps and deletes the buffer
+void free_ring_buffer(RingBuffer *ring) {
+	for (u32 r = 0; r < RING_REGIONS; r++) {
+		if (ring->fences[r]) {
+			glClientWaitSync(ring->fences[r], GL_SYNC_FLUSH_COMMANDS_BIT, ~(GLuint64)0);
+			GL_CHECK(glDeleteSync(ring->fences[r]));
+		}
+	}
+	if (ring->persistent) {
+		GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, ring->buffer));
+		GL_CHECK(glUnmapBuffer(GL_COPY_READ_BUFFER));
+	}
+	GL_CHECK(glDeleteBuffers(1, &ring->buffer));
+	memset(ring, 0, sizeof(RingBuffer));
+}
+
+#endif
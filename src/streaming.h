@@ -0,0 +1,374 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "chunk.h"
+#include "chunk_map.h"
+#include "edit.h"
+#include "jobs.h"
+#include "region.h"
+#include "timer.h"
+
+// Streams chunks in and out around the camera. The world is a square of
+// (2 * (radius + 1) + 1)^2 chunk slots centred on the camera's chunk,
+// addressed through find_chunk, so a chunk coming into range takes over the
+// slot of the one that just left on the opposite side.
+//
+// Chunks within radius + 1 of the centre are generated, those within radius
+// are also hulled once all eight neighbours exist, and only hulled chunks are
+// drawn. Every chunk the stream holds is in its chunk map; hulled chunks that
+// leave the loaded area are released there rather than freed, and come back
+// without any work if the camera returns before they are evicted.
+//
+// With a region store, chunks are loaded from disk when they have been saved
+// and generated otherwise, and every chunk that was not loaded as it is is
+// saved when the stream lets go of it.
+//
+// Generation and hulling run as jobs that hand their results back through a
+// completion list; every slot change happens on the thread calling
+// update_chunk_stream, which never waits on a job.
+
+typedef enum SlotState {
+	SLOT_EMPTY,
+	SLOT_GENERATING,
+	SLOT_GENERATED,
+	SLOT_HULLING,
+	SLOT_READY,
+} SlotState;
+
+typedef struct StreamResult {
+	u32 slot;
+	Chunk *chunk;
+} StreamResult;
+
+typedef struct StreamStats {
+	u32 loaded;
+	u32 unloaded;
+	// Chunks read from the region store rather than generated
+	u32 read;
+	// Chunks brought back from the map's released chunks, and chunks evicted
+	u32 reused;
+	u32 evicted;
+	u32 in_flight;
+	// Request to ready, over the chunks loaded in this update
+	u64 latency_total_ns;
+	u64 latency_max_ns;
+} StreamStats;
+
+typedef struct ChunkStream {
+	JobSystem *jobs;
+	Chunk **chunks;
+	ChunkMap map;
+	// May be NULL, in which case nothing is loaded or saved
+	RegionStore *regions;
+	u32 radius;
+	u32 side;
+	// Released chunks kept before eviction starts
+	u32 cache_size;
+
+	u8 *state;
+	// Jobs reading a slot's chunk, which keep it from being unloaded
+	u32 *busy;
+	// Chunk coordinates a generating slot was requested for
+	i32 *want_x;
+	i32 *want_z;
+	u64 *requested_ns;
+
+	std::mutex results_lock;
+	StreamResult *results;
+	u32 num_results;
+	u32 results_capacity;
+
+	u32 in_flight;
+} ChunkStream;
+
+// Time spent running stream jobs on the updating thread per update, used
+// only when the job system has no workers of its own
+u64 stream_job_budget_ns = 4 * 1000 * 1000;
+
+// Sets the world size globals to the stream's slot grid
+ChunkStream *create_chunk_stream(JobSystem *jobs, RegionStore *regions, u32 radius) {
+	ChunkStream *stream = new ChunkStream();
+	stream->jobs = jobs;
+	stream->regions = regions;
+	stream->radius = radius;
+	stream->side = 2 * (radius + 1) + 1;
+
+	num_x_chunks = stream->side;
+	num_y_chunks = stream->side;
+	num_chunks = num_x_chunks * num_y_chunks;
+
+	stream->chunks = (Chunk **)calloc(num_chunks, sizeof(Chunk *));
+	stream->map = {};
+	chunk_map_reset(&stream->map, num_chunks * 2);
+	stream->cache_size = num_chunks;
+	stream->state = (u8 *)calloc(num_chunks, sizeof(u8));
+	stream->busy = (u32 *)calloc(num_chunks, sizeof(u32));
+	stream->want_x = (i32 *)calloc(num_chunks, sizeof(i32));
+	stream->want_z = (i32 *)calloc(num_chunks, sizeof(i32));
+	stream->requested_ns = (u64 *)calloc(num_chunks, sizeof(u64));
+	stream->results = NULL;
+	stream->num_results = 0;
+	stream->results_capacity = 0;
+	stream->in_flight = 0;
+
+	return stream;
+}
+
+void push_stream_result(ChunkStream *stream, u32 slot, Chunk *chunk) {
+	std::lock_guard<std::mutex> guard(stream->results_lock);
+	if (stream->num_results == stream->results_capacity) {
+		stream->results_capacity = stream->results_capacity ? stream->results_capacity * 2 : 64;
+		stream->results = (StreamResult *)realloc(stream->results, sizeof(StreamResult) * stream->results_capacity);
+	}
+	stream->results[stream->num_results].slot = slot;
+	stream->results[stream->num_results].chunk = chunk;
+	stream->num_results++;
+}
+
+// Whether the chunk at (cx, cz) and the eight around it, which its hull
+// and ambient occlusion read, are all in their slots
+bool neighbourhood_loaded(ChunkStream *stream, i32 cx, i32 cz) {
+	for (i32 dz = -1; dz <= 1; dz++) {
+		for (i32 dx = -1; dx <= 1; dx++) {
+			if (!find_chunk(stream->chunks, cx + dx, cz + dz)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool neighbourhood_busy(ChunkStream *stream, i32 cx, i32 cz) {
+	for (i32 dz = -1; dz <= 1; dz++) {
+		for (i32 dx = -1; dx <= 1; dx++) {
+			if (stream->busy[chunk_slot(cx + dx, cz + dz)]) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void add_neighbourhood_busy(ChunkStream *stream, i32 cx, i32 cz, i32 delta) {
+	for (i32 dz = -1; dz <= 1; dz++) {
+		for (i32 dx = -1; dx <= 1; dx++) {
+			stream->busy[chunk_slot(cx + dx, cz + dz)] += delta;
+		}
+	}
+}
+
+void stream_generate_job(void *data, u32 slot) {
+	ChunkStream *stream = (ChunkStream *)data;
+	i32 cx = stream->want_x[slot];
+	i32 cz = stream->want_z[slot];
+	Chunk *chunk = stream->regions ? load_region_chunk(stream->regions, cx, cz) : NULL;
+	push_stream_result(stream, slot, chunk ? chunk : generate_chunk(cx, cz));
+}
+
+void stream_hull_job(void *data, u32 slot) {
+	ChunkStream *stream = (ChunkStream *)data;
+	hull_chunk(stream->chunks, slot);
+	update_chunk(stream->chunks, slot);
+	push_stream_result(stream, slot, stream->chunks[slot]);
+}
+
+bool chunk_ready(ChunkStream *stream, u32 slot) {
+	return stream->state[slot] == SLOT_READY;
+}
+
+void take_stream_results(ChunkStream *stream, StreamStats *stats) {
+	std::lock_guard<std::mutex> guard(stream->results_lock);
+	u64 now = get_time_ns();
+
+	for (u32 r = 0; r < stream->num_results; r++) {
+		StreamResult *result = &stream->results[r];
+		u32 slot = result->slot;
+		stream->in_flight--;
+
+		if (stream->state[slot] == SLOT_GENERATING) {
+			stream->busy[slot]--;
+			stream->chunks[slot] = result->chunk;
+			stream->state[slot] = SLOT_GENERATED;
+			chunk_map_insert(&stream->map, result->chunk);
+			stats->read += result->chunk->saved;
+		} else if (stream->state[slot] == SLOT_HULLING) {
+			Chunk *chunk = result->chunk;
+			i32 cx = chunk->x_off / (i32)chunk_width;
+			i32 cz = chunk->z_off / (i32)chunk_depth;
+			add_neighbourhood_busy(stream, cx, cz, -1);
+			stream->state[slot] = SLOT_READY;
+
+			u64 latency = now - stream->requested_ns[slot];
+			stats->loaded++;
+			stats->latency_total_ns += latency;
+			stats->latency_max_ns = latency > stats->latency_max_ns ? latency : stats->latency_max_ns;
+		}
+	}
+	stream->num_results = 0;
+}
+
+// Saves the chunk if the region store lacks it, then frees it
+void retire_chunk(ChunkStream *stream, Chunk *chunk) {
+	if (stream->regions && !chunk->saved) {
+		save_region_chunk(stream->regions, chunk);
+	}
+	free_chunk(chunk);
+}
+
+// Hulled chunks are released to the map, anything else is cheaper to
+// load or generate again
+void unload_slot(ChunkStream *stream, u32 slot, StreamStats *stats) {
+	Chunk *chunk = stream->chunks[slot];
+	if (stream->state[slot] == SLOT_READY) {
+		chunk_map_release(&stream->map, chunk);
+		stats->unloaded++;
+	} else {
+		chunk_map_remove(&stream->map, chunk);
+		retire_chunk(stream, chunk);
+	}
+	stream->chunks[slot] = NULL;
+	stream->state[slot] = SLOT_EMPTY;
+}
+
+void stream_evict_chunk(Chunk *chunk, void *data) {
+	retire_chunk((ChunkStream *)data, chunk);
+}
+
+// Moves the loaded area to be centred on the camera's chunk and queues the
+// jobs that are now possible, nearest rings first. The chunks array keeps the
+// same address and size for the stream's lifetime; slots only change here.
+void update_chunk_stream(ChunkStream *stream, glm::vec3 camera, StreamStats *stats) {
+	TRACE_SCOPE("update_chunk_stream");
+	take_stream_results(stream, stats);
+
+	i32 center_x = (i32)floorf(camera.x / chunk_width);
+	i32 center_z = (i32)floorf(camera.z / chunk_depth);
+	i32 reach = stream->radius + 1;
+
+	for (i32 ring = 0; ring <= reach; ring++) {
+		for (i32 cz = center_z - ring; cz <= center_z + ring; cz++) {
+			// Only the border of the ring, the inside was visited already
+			i32 step = (cz == center_z - ring || cz == center_z + ring) ? 1 : 2 * ring;
+			for (i32 cx = center_x - ring; cx <= center_x + ring; cx += step) {
+				u32 slot = chunk_slot(cx, cz);
+				u8 state = stream->state[slot];
+
+				if (state == SLOT_GENERATING) {
+					continue;
+				}
+
+				Chunk *chunk = stream->chunks[slot];
+				if (chunk && (chunk->x_off != cx * (i32)chunk_width || chunk->z_off != cz * (i32)chunk_depth)) {
+					// Left over from the other side of the loaded area
+					if (stream->busy[slot] > 0 || state == SLOT_HULLING) {
+						continue;
+					}
+					unload_slot(stream, slot, stats);
+					state = SLOT_EMPTY;
+				}
+
+				if (state == SLOT_EMPTY && (chunk = chunk_map_find(&stream->map, cx, cz))) {
+					// Released earlier and still hulled; only its render data
+					// has to be rebuilt for this slot
+					chunk_map_acquire(&stream->map, chunk);
+					chunk->dirty = true;
+					chunk->mesh_dirty = true;
+					stream->chunks[slot] = chunk;
+					stream->state[slot] = SLOT_READY;
+					stats->reused++;
+				} else if (state == SLOT_EMPTY) {
+					stream->want_x[slot] = cx;
+					stream->want_z[slot] = cz;
+					stream->requested_ns[slot] = get_time_ns();
+					stream->state[slot] = SLOT_GENERATING;
+					stream->busy[slot]++;
+					stream->in_flight++;
+					push_job(stream->jobs, stream_generate_job, stream, slot);
+				} else if (state == SLOT_GENERATED && ring <= (i32)stream->radius && neighbourhood_loaded(stream, cx, cz)) {
+					stream->state[slot] = SLOT_HULLING;
+					add_neighbourhood_busy(stream, cx, cz, 1);
+					stream->in_flight++;
+					push_job(stream->jobs, stream_hull_job, stream, slot);
+				}
+			}
+		}
+	}
+
+	stats->evicted += chunk_map_evict(&stream->map, stream->cache_size, stream_evict_chunk, stream);
+
+	if (stream->jobs->num_workers == 1) {
+		u64 start = get_time_ns();
+		while (get_time_ns() - start < stream_job_budget_ns && try_run_job(stream->jobs)) {
+		}
+	}
+
+	stats->in_flight = stream->in_flight;
+}
+
+// Applies set_block to the block at world position (x, y, z). Refused while
+// the chunk is not drawn or a job is reading it or any of its eight
+// neighbours, since the edit may rewrite them all.
+bool edit_stream_block(ChunkStream *stream, i32 x, i32 y, i32 z, bool solid) {
+	i32 cx = (i32)floorf((f32)x / chunk_width);
+	i32 cz = (i32)floorf((f32)z / chunk_depth);
+	u32 slot = chunk_slot(cx, cz);
+	Chunk *chunk = find_chunk(stream->chunks, cx, cz);
+	if (!chunk || !chunk_ready(stream, slot) || y < 0) {
+		return false;
+	}
+
+	if (neighbourhood_busy(stream, cx, cz)) {
+		return false;
+	}
+
+	return set_block(chunk, x - chunk->x_off, y, z - chunk->z_off, solid);
+}
+
+// Loads everything around the camera before the first frame, the only place
+// that waits on stream jobs
+void fill_chunk_stream(ChunkStream *stream, glm::vec3 camera) {
+	TRACE_SCOPE("fill_chunk_stream");
+	StreamStats stats;
+	memset(&stats, 0, sizeof(stats));
+	for (;;) {
+		update_chunk_stream(stream, camera, &stats);
+		if (stream->in_flight == 0) {
+			break;
+		}
+		wait_for_jobs(stream->jobs);
+	}
+}
+
+// Waits for jobs still reading the chunks, then saves and frees everything
+void free_chunk_stream(ChunkStream *stream) {
+	wait_for_jobs(stream->jobs);
+	StreamStats stats;
+	memset(&stats, 0, sizeof(stats));
+	take_stream_results(stream, &stats);
+
+	// Loaded and released chunks alike are in the map
+	for (u32 i = 0; i < stream->map.capacity; i++) {
+		if (stream->map.values[i]) {
+			retire_chunk(stream, stream->map.values[i]);
+		}
+	}
+
+	free_chunk_map(&stream->map);
+	free(stream->chunks);
+	free(stream->state);
+	free(stream->busy);
+	free(stream->want_x);
+	free(stream->want_z);
+	free(stream->requested_ns);
+	free(stream->results);
+	delete stream;
+}
+
+#endif
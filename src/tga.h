@@ -1,6 +1,14 @@
 #ifndef TGA_H
 #define TGA_H
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "common.h"
 
 typedef struct Color {
@@ -15,6 +23,7 @@ typedef struct Color {
 	};
 } Color;
 
+// Rows bottom up; pixels are grey, BGR or BGRA for 1, 3 or 4 bytes per pixel
 typedef struct Image {
     u16 width;
     u16 height;
@@ -22,20 +31,6 @@ typedef struct Image {
     u8 *data;
 } Image;
 
-typedef struct TGAHeader {
-    u8 id_len;
-    u8 colormap_t;
-    u8 data_t;
-    u16 colormap_origin;
-    u8 colormap_depth;
-    u16 x_origin;
-    u16 y_origin;
-    u16 width;
-    u16 height;
-    u8 bits_per_pixel;
-    u8 img_desc;
-} TGAHeader;
-
 void print_color(Color c) {
 	printf("#%x%x%x%x\n", c.red, c.green, c.blue, c.alpha);
 }
@@ -59,58 +54,425 @@ Color rgb_to_color(u8 r, u8 g, u8 b) {
 	return c;
 }
 
-void write_tga(const char *filename, Image *img) {
-    FILE *out_file = fopen(filename, "wb");
+// TGA image types: uncompressed true colour and greyscale, and their
+// run-length encoded versions
+#define TGA_TRUE_COLOR 2
+#define TGA_GREY 3
+#define TGA_RLE_TRUE_COLOR 10
+#define TGA_RLE_GREY 11
+
+#define TGA_HEADER_SIZE 18
+// Image descriptor bits
+#define TGA_RIGHT_TO_LEFT 0x10
+#define TGA_TOP_DOWN 0x20
+
+// Pixels in one RLE packet
+#define TGA_MAX_PACKET 128
+// Shortest run of equal pixels that ends a raw packet and starts a run
+#define TGA_MIN_RUN 3
+
+#define TGA_BUFFER_SIZE (64 * 1024)
+
+// Writes a TGA file from pixels handed over in pieces of any size, rows
+// in file order, so an image spread over many buffers is written without
+// gathering it first. Output goes through the writer's own buffer straight
+// to write(2). RLE packets are encoded into that buffer and never cross a
+// row, but do carry on from one piece to the next.
+typedef struct TgaWriter {
+	FILE *file;
+	u16 width;
+	u16 height;
+	u8 bytes_per_pixel;
+	bool rle;
+	// Pixels of the current row written so far, and rows finished
+	u32 column;
+	u32 rows;
+	// The open RLE packet, if any: run_count copies of run_pixel, or
+	// raw_count pixels after the header byte at buffer[raw_header]
+	u32 run_count;
+	u8 run_pixel[4];
+	u32 raw_count;
+	u32 raw_header;
+	u8 *buffer;
+	u32 used;
+	bool failed;
+} TgaWriter;
+
+void flush_tga_buffer(TgaWriter *writer) {
+	if (writer->used && fwrite(writer->buffer, 1, writer->used, writer->file) != writer->used) {
+		writer->failed = true;
+	}
+	writer->used = 0;
+}
+
+// Makes room for bytes more in the buffer. Only called with no raw packet
+// open, whose header byte would be flushed before it is filled in.
+void reserve_tga_buffer(TgaWriter *writer, u32 bytes) {
+	if (writer->used + bytes > TGA_BUFFER_SIZE) {
+		flush_tga_buffer(writer);
+	}
+}
+
+// bytes_per_pixel is 1 for greyscale, 3 or 4 for BGR(A). Rows are written
+// top down when top_down is set, else bottom up as GL reads them back.
+bool open_tga_writer(TgaWriter *writer, const char *filename, u16 width, u16 height, u8 bytes_per_pixel, bool rle, bool top_down) {
+	memset(writer, 0, sizeof(TgaWriter));
+	if (bytes_per_pixel != 1 && bytes_per_pixel != 3 && bytes_per_pixel != 4) {
+		return false;
+	}
+	writer->file = fopen(filename, "wb");
+	if (!writer->file) {
+		return false;
+	}
+	// Everything is written in TGA_BUFFER_SIZE blocks, or bigger
+	setvbuf(writer->file, NULL, _IONBF, 0);
+	// Room for tga_find_run to read past the end
+	writer->buffer = (u8 *)calloc(TGA_BUFFER_SIZE + 32, 1);
+	writer->width = width;
+	writer->height = height;
+	writer->bytes_per_pixel = bytes_per_pixel;
+	writer->rle = rle;
+
+	u8 *header = writer->buffer;
+	memset(header, 0, TGA_HEADER_SIZE);
+	if (bytes_per_pixel == 1) {
+		header[2] = rle ? TGA_RLE_GREY : TGA_GREY;
+	} else {
+		header[2] = rle ? TGA_RLE_TRUE_COLOR : TGA_TRUE_COLOR;
+	}
+	header[12] = width & 0xff;
+	header[13] = width >> 8;
+	header[14] = height & 0xff;
+	header[15] = height >> 8;
+	header[16] = bytes_per_pixel * 8;
+	// Alpha bits, then the origin
+	header[17] = (bytes_per_pixel == 4 ? 8 : 0) | (top_down ? TGA_TOP_DOWN : 0);
+	writer->used = TGA_HEADER_SIZE;
+	return true;
+}
+
+bool same_tga_pixel(const u8 *a, const u8 *b, u32 bytes_per_pixel) {
+	if (bytes_per_pixel == 1) {
+		return a[0] == b[0];
+	}
+	return a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && (bytes_per_pixel == 3 || a[3] == b[3]);
+}
+
+// Leading pixels of count that equal pixel
+u32 tga_run_length(const u8 *pixels, u32 count, const u8 *pixel, u32 bytes_per_pixel) {
+	u32 i = 0;
+#if defined(__SSE2__)
+	if (bytes_per_pixel == 1 || bytes_per_pixel == 4) {
+		__m128i value;
+		if (bytes_per_pixel == 1) {
+			value = _mm_set1_epi8((char)pixel[0]);
+		} else {
+			u32 v;
+			memcpy(&v, pixel, 4);
+			value = _mm_set1_epi32((i32)v);
+		}
+		u32 per_vector = 16 / bytes_per_pixel;
+		for (; i + per_vector <= count; i += per_vector) {
+			__m128i block = _mm_loadu_si128((const __m128i *)(pixels + i * bytes_per_pixel));
+			u32 equal = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(block, value));
+			if (equal != 0xffff) {
+				return i + (u32)__builtin_ctz(~equal) / bytes_per_pixel;
+			}
+		}
+	}
+#endif
+	for (; i < count && same_tga_pixel(pixels + i * bytes_per_pixel, pixel, bytes_per_pixel); i++) {
+	}
+	return i;
+}
+
+// First pixel from from on that starts TGA_MIN_RUN equal ones, or count.
+// May read up to 32 bytes past the last pixel, though never uses them.
+u32 tga_find_run(const u8 *pixels, u32 from, u32 count, u32 bytes_per_pixel) {
+	if (count < from + TGA_MIN_RUN) {
+		return count;
+	}
+	u32 last = count - TGA_MIN_RUN;
+	u32 i = from;
+#if defined(__SSE2__)
+	if (bytes_per_pixel == 1 || bytes_per_pixel == 4) {
+		// Compares every pixel with the next two at once
+		u32 per_vector = 16 / bytes_per_pixel;
+		for (; i <= last; i += per_vector) {
+			const u8 *p = pixels + i * bytes_per_pixel;
+			__m128i a = _mm_loadu_si128((const __m128i *)p);
+			__m128i b = _mm_loadu_si128((const __m128i *)(p + bytes_per_pixel));
+			__m128i c = _mm_loadu_si128((const __m128i *)(p + 2 * bytes_per_pixel));
+			__m128i same = _mm_and_si128(_mm_cmpeq_epi8(a, b), _mm_cmpeq_epi8(b, c));
+			if (bytes_per_pixel == 4) {
+				same = _mm_cmpeq_epi32(same, _mm_set1_epi32(-1));
+			}
+			u32 mask = (u32)_mm_movemask_epi8(same);
+			u32 valid = last - i + 1;
+			if (valid < per_vector) {
+				mask &= (1u << (valid * bytes_per_pixel)) - 1;
+			}
+			if (mask) {
+				return i + (u32)__builtin_ctz(mask) / bytes_per_pixel;
+			}
+		}
+		return count;
+	}
+#endif
+	for (; i <= last; i++) {
+		const u8 *p = pixels + i * bytes_per_pixel;
+		if (same_tga_pixel(p, p + bytes_per_pixel, bytes_per_pixel) && same_tga_pixel(p, p + 2 * bytes_per_pixel, bytes_per_pixel)) {
+			return i;
+		}
+	}
+	return count;
+}
 
-    u8 dev_ref[4] = {0, 0, 0, 0};
-    u8 ext_ref[4] = {0, 0, 0, 0};
-    u8 footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
+void close_tga_packet(TgaWriter *writer) {
+	if (writer->run_count) {
+		reserve_tga_buffer(writer, 1 + writer->bytes_per_pixel);
+		writer->buffer[writer->used++] = 0x80 | (u8)(writer->run_count - 1);
+		memcpy(writer->buffer + writer->used, writer->run_pixel, writer->bytes_per_pixel);
+		writer->used += writer->bytes_per_pixel;
+		writer->run_count = 0;
+	} else if (writer->raw_count) {
+		writer->buffer[writer->raw_header] = (u8)(writer->raw_count - 1);
+		writer->raw_count = 0;
+	}
+}
+
+// Encodes count pixels that lie within one row. Pixels go straight into
+// the open raw packet, which is then searched for a run, so runs are found
+// a vector at a time however small the pieces, and across them.
+void encode_tga_pixels(TgaWriter *writer, const u8 *pixels, u32 count) {
+	u32 bpp = writer->bytes_per_pixel;
+	u32 i = 0;
+	while (i < count) {
+		if (writer->run_count) {
+			u32 room = TGA_MAX_PACKET - writer->run_count;
+			u32 length = tga_run_length(pixels + i * bpp, count - i < room ? count - i : room, writer->run_pixel, bpp);
+			writer->run_count += length;
+			i += length;
+			// A run reaching the end of the piece may go on in the next
+			if (i < count || writer->run_count == TGA_MAX_PACKET) {
+				close_tga_packet(writer);
+			}
+			continue;
+		}
 
-    TGAHeader header;
-    memset((void *)&header, 0, sizeof(header));
-    header.bits_per_pixel = img->bytes_per_pixel << 3;
-    header.width = img->width;
-    header.height = img->height;
-    header.data_t = 2;
-    header.img_desc = 0x10;
+		if (!writer->raw_count) {
+			reserve_tga_buffer(writer, 1 + TGA_MAX_PACKET * bpp);
+			writer->raw_header = writer->used++;
+		}
+		u8 *packet = writer->buffer + writer->raw_header + 1;
+		u32 start = writer->raw_count;
+		u32 take = TGA_MAX_PACKET - start;
+		take = count - i < take ? count - i : take;
+		memcpy(packet + start * bpp, pixels + i * bpp, take * bpp);
+		writer->raw_count += take;
+		writer->used += take * bpp;
+		i += take;
 
-    fwrite(&header, 1, sizeof(TGAHeader), out_file);
-    fwrite((char *)img->data, 1, img->width * img->height * img->bytes_per_pixel, out_file);
-    fwrite(dev_ref, 1, sizeof(dev_ref), out_file);
-    fwrite(ext_ref, 1, sizeof(ext_ref), out_file);
-    fwrite(footer, 1, sizeof(footer), out_file);
+		// A run may begin up to two pixels before the new ones
+		u32 total = writer->raw_count;
+		u32 run = tga_find_run(packet, start > TGA_MIN_RUN - 1 ? start - (TGA_MIN_RUN - 1) : 0, total, bpp);
+		if (run == total) {
+			if (total == TGA_MAX_PACKET) {
+				close_tga_packet(writer);
+			}
+			continue;
+		}
 
-    fclose(out_file);
+		// The raw packet ends where the run starts; pixels copied past the
+		// run go through the loop again
+		u32 length = tga_run_length(packet + run * bpp, total - run, packet + run * bpp, bpp);
+		memcpy(writer->run_pixel, packet + run * bpp, bpp);
+		i -= total - (run + length);
+		writer->raw_count = run;
+		if (run) {
+			writer->used = writer->raw_header + 1 + run * bpp;
+			close_tga_packet(writer);
+		} else {
+			writer->used = writer->raw_header;
+		}
+		writer->run_count = length;
+		if (run + length < total || length == TGA_MAX_PACKET) {
+			close_tga_packet(writer);
+		}
+	}
 }
 
-void write_tga_bitmap(const char *filename, Image *img) {
-    FILE *out_file = fopen(filename, "wb");
+// Appends count pixels, which may run on over any number of rows
+void write_tga_pixels(TgaWriter *writer, const u8 *pixels, u64 count) {
+	u32 bpp = writer->bytes_per_pixel;
+	while (count > 0) {
+		u32 piece = writer->width - writer->column;
+		piece = count < piece ? (u32)count : piece;
 
-    u8 dev_ref[4] = {0, 0, 0, 0};
-    u8 ext_ref[4] = {0, 0, 0, 0};
-    u8 footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
+		if (writer->rle) {
+			encode_tga_pixels(writer, pixels, piece);
+		} else if (piece * bpp > TGA_BUFFER_SIZE / 2) {
+			flush_tga_buffer(writer);
+			if (fwrite(pixels, 1, piece * bpp, writer->file) != piece * bpp) {
+				writer->failed = true;
+			}
+		} else {
+			reserve_tga_buffer(writer, piece * bpp);
+			memcpy(writer->buffer + writer->used, pixels, piece * bpp);
+			writer->used += piece * bpp;
+		}
 
-	Color *bitmap = (Color *)malloc(img->width * img->height * sizeof(Color));
-	for (u32 i = 0; i < img->width * img->height; i++) {
- 		Color c = rgb_to_color(img->data[i], img->data[i], img->data[i]);
-		bitmap[i] = c;
+		writer->column += piece;
+		if (writer->column == writer->width) {
+			close_tga_packet(writer);
+			writer->column = 0;
+			writer->rows++;
+		}
+		pixels += (u64)piece * bpp;
+		count -= piece;
 	}
+}
 
-    TGAHeader header;
-    memset((void *)&header, 0, sizeof(header));
-    header.bits_per_pixel = 32;
-    header.width = img->width;
-    header.height = img->height;
-    header.data_t = 2;
-    header.img_desc = 0x10;
+// Writes the footer and closes the file; false when it could not be written
+// or did not get every pixel
+bool close_tga_writer(TgaWriter *writer) {
+	if (!writer->file) {
+		return false;
+	}
 
-    fwrite(&header, 1, sizeof(TGAHeader), out_file);
-    fwrite((char *)bitmap, 1, img->width * img->height * 4, out_file);
-    fwrite(dev_ref, 1, sizeof(dev_ref), out_file);
-    fwrite(ext_ref, 1, sizeof(ext_ref), out_file);
-    fwrite(footer, 1, sizeof(footer), out_file);
+	static const u8 footer[26] = {
+		0, 0, 0, 0, 0, 0, 0, 0,
+		'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0',
+	};
+	reserve_tga_buffer(writer, sizeof(footer));
+	memcpy(writer->buffer + writer->used, footer, sizeof(footer));
+	writer->used += sizeof(footer);
+	flush_tga_buffer(writer);
 
-    fclose(out_file);
+	bool complete = writer->rows == writer->height && writer->column == 0;
+	bool written = !writer->failed && !ferror(writer->file);
+	written = fclose(writer->file) == 0 && written;
+	free(writer->buffer);
+	writer->file = NULL;
+	writer->buffer = NULL;
+	return written && complete;
+}
+
+// Writes img as it is stored, bottom up; returns false when the file could
+// not be written
+bool write_tga(const char *filename, Image *img, bool rle) {
+	TgaWriter writer;
+	if (!open_tga_writer(&writer, filename, img->width, img->height, img->bytes_per_pixel, rle, false)) {
+		return false;
+	}
+	write_tga_pixels(&writer, img->data, (u64)img->width * img->height);
+	return close_tga_writer(&writer);
+}
+
+// Reads a greyscale or true colour TGA, compressed or not, into img, rows
+// bottom up whichever way the file stores them. img->data is allocated
+// here; returns false, allocating nothing, for files it cannot read.
+bool read_tga(const char *filename, Image *img) {
+	FILE *file = fopen(filename, "rb");
+	if (!file) {
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size < TGA_HEADER_SIZE) {
+		fclose(file);
+		return false;
+	}
+	u8 *contents = (u8 *)malloc(size);
+	bool read = fread(contents, 1, size, file) == (size_t)size;
+	fclose(file);
+
+	u8 *header = contents;
+	u32 type = header[2];
+	u32 width = header[12] | (header[13] << 8);
+	u32 height = header[14] | (header[15] << 8);
+	u32 bpp = header[16] / 8;
+	u32 desc = header[17];
+	bool grey = type == TGA_GREY || type == TGA_RLE_GREY;
+	bool rle = type == TGA_RLE_TRUE_COLOR || type == TGA_RLE_GREY;
+	if (!read || header[1] != 0 || (desc & TGA_RIGHT_TO_LEFT) ||
+		!(grey ? bpp == 1 : (type == TGA_TRUE_COLOR || type == TGA_RLE_TRUE_COLOR) && (bpp == 3 || bpp == 4))) {
+		free(contents);
+		return false;
+	}
+
+	u8 *data = (u8 *)malloc((u64)width * height * bpp + 1);
+	const u8 *src = contents + TGA_HEADER_SIZE + header[0];
+	const u8 *end = contents + size;
+	u32 row_bytes = width * bpp;
+	bool top_down = desc & TGA_TOP_DOWN;
+	bool ok = true;
+
+	// Packets may cross rows in files from elsewhere, so the row being
+	// filled is tracked separately
+	u32 row = 0;
+	u32 column = 0;
+	while (ok && row < height) {
+		u8 *dst = data + (u64)(top_down ? height - 1 - row : row) * row_bytes;
+		if (!rle) {
+			if (src + row_bytes > end) {
+				ok = false;
+				break;
+			}
+			memcpy(dst, src, row_bytes);
+			src += row_bytes;
+			row++;
+			continue;
+		}
+
+		if (src >= end) {
+			ok = false;
+			break;
+		}
+		u32 packet = *src++;
+		u32 count = (packet & 0x7f) + 1;
+		bool run = packet & 0x80;
+		if (src + (run ? bpp : count * bpp) > end) {
+			ok = false;
+			break;
+		}
+		while (count > 0 && row < height) {
+			dst = data + (u64)(top_down ? height - 1 - row : row) * row_bytes;
+			u32 take = width - column < count ? width - column : count;
+			u8 *out = dst + column * bpp;
+			if (!run) {
+				memcpy(out, src, take * bpp);
+				src += take * bpp;
+			} else if (bpp == 1) {
+				memset(out, src[0], take);
+			} else {
+				for (u32 i = 0; i < take; i++) {
+					memcpy(out + i * bpp, src, bpp);
+				}
+			}
+			column += take;
+			count -= take;
+			if (column == width) {
+				column = 0;
+				row++;
+			}
+		}
+		if (run) {
+			src += bpp;
+		}
+	}
+	free(contents);
+
+	if (!ok) {
+		free(data);
+		return false;
+	}
+	img->width = width;
+	img->height = height;
+	img->bytes_per_pixel = bpp;
+	img->data = data;
+	return true;
 }
 
 #endif
@@ -0,0 +1,31 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <time.h>
+#include <sys/resource.h>
+
+#include "common.h"
+
+// Monotonic wall clock in nanoseconds, usable without SDL
+u64 get_time_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ul + (u64)ts.tv_nsec;
+}
+
+f64 ns_to_ms(u64 ns) {
+	return (f64)ns / 1000000.0;
+}
+
+// High water mark of resident memory for the whole process, in kilobytes
+u64 get_peak_rss_kb() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return (u64)usage.ru_maxrss / 1024;
+#else
+	return (u64)usage.ru_maxrss;
+#endif
+}
+
+#endif
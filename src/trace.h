@@ -0,0 +1,227 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "common.h"
+#include "timer.h"
+
+// Scoped timers written as a Chrome trace (chrome://tracing, Perfetto).
+// TRACE_SCOPE(name) records how long the rest of the enclosing block takes
+// on the calling thread. Each thread has its own ring of events, so
+// recording is a clock read at each end of the scope and two stores; only
+// the newest TRACE_RING_SIZE events of each thread are kept.
+//
+// TRACE_BEGIN(var, name) and TRACE_END(var) do the same for a section that
+// does not fit a block.
+//
+// Nothing is recorded until trace_start. Built with TRACING 0, the macros
+// expand to nothing and the rest of the interface does nothing.
+
+#ifndef TRACING
+#define TRACING 1
+#endif
+
+#define TRACE_RING_SIZE (1 << 16)
+#define MAX_TRACE_THREADS 64
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#if TRACING
+
+typedef struct TraceEvent {
+	// A string literal, written to the trace as it is
+	const char *name;
+	u64 start_ns;
+	u64 duration_ns;
+} TraceEvent;
+
+// One thread's events, or those of a track that is not a thread, such as
+// GPU timings. Only its owner writes to it.
+typedef struct TraceRing {
+	TraceEvent events[TRACE_RING_SIZE];
+	// Events ever recorded; the ring holds the last TRACE_RING_SIZE of them
+	std::atomic<u64> head;
+	u32 tid;
+	char name[32];
+} TraceRing;
+
+std::atomic<TraceRing *> trace_rings[MAX_TRACE_THREADS];
+std::atomic<u32> trace_num_rings(0);
+std::atomic<bool> trace_enabled(false);
+u64 trace_epoch_ns = 0;
+
+// The calling thread's ring, made when it first records an event
+thread_local TraceRing *trace_thread_ring = NULL;
+thread_local char trace_thread_name[32];
+
+// Registers a new ring, NULL once MAX_TRACE_THREADS are taken
+TraceRing *new_trace_track(const char *name) {
+	u32 tid = trace_num_rings++;
+	if (tid >= MAX_TRACE_THREADS) {
+		return NULL;
+	}
+
+	TraceRing *ring = new TraceRing();
+	ring->head = 0;
+	ring->tid = tid;
+	snprintf(ring->name, sizeof(ring->name), "%s", name);
+	trace_rings[tid].store(ring, std::memory_order_release);
+	return ring;
+}
+
+TraceRing *get_trace_thread_ring() {
+	if (!trace_thread_ring) {
+		if (!trace_thread_name[0]) {
+			snprintf(trace_thread_name, sizeof(trace_thread_name), "thread %u", trace_num_rings.load());
+		}
+		trace_thread_ring = new_trace_track(trace_thread_name);
+	}
+	return trace_thread_ring;
+}
+
+// Names the calling thread in the trace
+void trace_name_thread(const char *name) {
+	snprintf(trace_thread_name, sizeof(trace_thread_name), "%s", name);
+	if (trace_thread_ring) {
+		snprintf(trace_thread_ring->name, sizeof(trace_thread_ring->name), "%s", name);
+	}
+}
+
+void trace_push(TraceRing *ring, const char *name, u64 start_ns, u64 duration_ns) {
+	if (!ring) {
+		return;
+	}
+	u64 head = ring->head.load(std::memory_order_relaxed);
+	TraceEvent *event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+	event->name = name;
+	event->start_ns = start_ns;
+	event->duration_ns = duration_ns;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+typedef struct TraceScope {
+	const char *name;
+	u64 start_ns;
+
+	TraceScope(const char *scope_name) {
+		name = scope_name;
+		start_ns = trace_enabled.load(std::memory_order_relaxed) ? get_time_ns() : 0;
+	}
+
+	void end() {
+		if (start_ns) {
+			trace_push(get_trace_thread_ring(), name, start_ns, get_time_ns() - start_ns);
+			start_ns = 0;
+		}
+	}
+
+	~TraceScope() {
+		end();
+	}
+} TraceScope;
+
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_BEGIN(var, name) TraceScope var(name)
+#define TRACE_END(var) var.end()
+
+// Starts recording; timestamps in the trace count from here
+void trace_start() {
+	trace_epoch_ns = get_time_ns();
+	trace_enabled = true;
+}
+
+void trace_stop() {
+	trace_enabled = false;
+}
+
+// Writes every ring's events as Chrome trace_event JSON. Events recorded
+// while this runs may be torn, so stop tracing or let threads go idle first.
+bool write_chrome_trace(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (!file) {
+		return false;
+	}
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	bool first = true;
+	u32 num_rings = trace_num_rings.load();
+	for (u32 t = 0; t < num_rings && t < MAX_TRACE_THREADS; t++) {
+		TraceRing *ring = trace_rings[t].load(std::memory_order_acquire);
+		if (!ring) {
+			continue;
+		}
+
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",\n", ring->tid, ring->name);
+		first = false;
+
+		u64 head = ring->head.load(std::memory_order_acquire);
+		u64 begin = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+		for (u64 i = begin; i < head; i++) {
+			TraceEvent *event = &ring->events[i & (TRACE_RING_SIZE - 1)];
+			if (event->start_ns < trace_epoch_ns) {
+				continue;
+			}
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					event->name, ring->tid, (f64)(event->start_ns - trace_epoch_ns) / 1000.0, (f64)event->duration_ns / 1000.0);
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	return fclose(file) == 0;
+}
+
+// Events in every ring, for checking that tracing recorded anything
+u64 trace_event_count() {
+	u64 count = 0;
+	u32 num_rings = trace_num_rings.load();
+	for (u32 t = 0; t < num_rings && t < MAX_TRACE_THREADS; t++) {
+		TraceRing *ring = trace_rings[t].load(std::memory_order_acquire);
+		if (ring) {
+			u64 head = ring->head.load(std::memory_order_acquire);
+			count += head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+		}
+	}
+	return count;
+}
+
+#else
+
+typedef struct TraceRing TraceRing;
+
+#define TRACE_SCOPE(name)
+#define TRACE_BEGIN(var, name)
+#define TRACE_END(var)
+
+TraceRing *new_trace_track(const char *name) {
+	return NULL;
+}
+
+void trace_name_thread(const char *name) {
+}
+
+void trace_push(TraceRing *ring, const char *name, u64 start_ns, u64 duration_ns) {
+}
+
+void trace_start() {
+}
+
+void trace_stop() {
+}
+
+bool write_chrome_trace(const char *path) {
+	return false;
+}
+
+u64 trace_event_count() {
+	return 0;
+}
+
+#endif
+
+#endif
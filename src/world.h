@@ -0,0 +1,87 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <atomic>
+#include <mutex>
+
+#include "common.h"
+#include "point.h"
+#include "chunk.h"
+#include "chunk_map.h"
+#include "jobs.h"
+
+// Parallel world build. Every chunk is generated as its own job; hulling
+// reads the four neighbouring chunks and ambient occlusion the diagonal ones
+// too, so a chunk's hull_chunk + update_chunk job is queued by whichever
+// generate job finishes last among the chunk and its eight neighbours, by
+// which point they have all been linked.
+
+typedef struct WorldBuild {
+	Chunk **chunks;
+	JobSystem *jobs;
+	std::atomic<u32> *deps;
+	// Only links neighbours; chunks keep their links after the build
+	ChunkMap map;
+	std::mutex map_lock;
+} WorldBuild;
+
+void hull_chunk_job(void *data, u32 chunk_idx) {
+	WorldBuild *build = (WorldBuild *)data;
+	hull_chunk(build->chunks, chunk_idx);
+	update_chunk(build->chunks, chunk_idx);
+}
+
+void release_chunk_dep(WorldBuild *build, u32 chunk_idx) {
+	if (--build->deps[chunk_idx] == 0) {
+		push_job(build->jobs, hull_chunk_job, build, chunk_idx);
+	}
+}
+
+void generate_chunk_job(void *data, u32 chunk_idx) {
+	WorldBuild *build = (WorldBuild *)data;
+	Point cp = oned_to_twod(chunk_idx, num_x_chunks);
+	Chunk *chunk = generate_chunk(cp.x, cp.y);
+	build->chunks[chunk_idx] = chunk;
+	{
+		std::lock_guard<std::mutex> guard(build->map_lock);
+		chunk_map_insert(&build->map, chunk);
+	}
+
+	for (i32 dy = -1; dy <= 1; dy++) {
+		for (i32 dx = -1; dx <= 1; dx++) {
+			i32 x = (i32)cp.x + dx;
+			i32 y = (i32)cp.y + dy;
+			if (x >= 0 && y >= 0 && x < (i32)num_x_chunks && y < (i32)num_y_chunks) {
+				release_chunk_dep(build, twod_to_oned(x, y, num_x_chunks));
+			}
+		}
+	}
+}
+
+// Fills chunks[0..num_chunks) with generated, hulled and updated chunks,
+// identical to running the three stages serially
+void build_world(JobSystem *jobs, Chunk **chunks) {
+	WorldBuild build;
+	build.chunks = chunks;
+	build.jobs = jobs;
+	build.deps = new std::atomic<u32>[num_chunks];
+	build.map = {};
+	chunk_map_reset(&build.map, num_chunks);
+
+	for (u32 i = 0; i < num_chunks; i++) {
+		Point cp = oned_to_twod(i, num_x_chunks);
+		u32 across = 1 + (cp.x > 0) + (cp.x < num_x_chunks - 1);
+		u32 down = 1 + (cp.y > 0) + (cp.y < num_y_chunks - 1);
+		build.deps[i] = across * down;
+	}
+
+	for (u32 i = 0; i < num_chunks; i++) {
+		push_job_to(jobs, i, generate_chunk_job, &build, i);
+	}
+	wait_for_jobs(jobs);
+
+	free_chunk_map(&build.map);
+	delete[] build.deps;
+}
+
+#endif